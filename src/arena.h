@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <new>
+#include <vector>
+
+/// Chunked [bump allocator](https://en.wikipedia.org/wiki/Region-based_memory_management).
+/// * Memory is carved out of large *pages* in allocation order,
+///     so objects that are allocated one after another are also adjacent in memory.
+/// * Freed blocks go to one free list per *size class* and are handed out again in O(1).
+/// * Giving back the most recent allocation simply rewinds the bump pointer.
+/// * All pages are released at once when the Arena dies; destructors are **not** invoked.
+/// * Pages are aligned to their size and start with a header that records the Arena's *owner*.
+///     Arena::owner thus finds the owner of any allocated block with a bit mask - no back pointer needed.
+///     For this reason, a block can't be larger than Arena::Max_Size.
+/// * Each block starts at a cache line and is rounded up to a multiple of Arena::Align;
+///     this trades up to `Align - 1` bytes per block for never splitting the first line of an object.
+class Arena {
+public:
+    static constexpr size_t Align            = 64;                ///< A cache line: the first `Align` bytes of a block never straddle two lines.
+    static constexpr size_t Num_Size_Classes = 32;                ///< Blocks up to `Num_Size_Classes * Align` bytes are recycled.
+    static constexpr size_t Page_Size        = 1024 * 1024;       ///< 1MB.
+    static constexpr size_t Max_Size         = Page_Size - Align; ///< Largest block: a page minus its header.
+
+    Arena(void* owner = nullptr)
+        : owner_(owner) {}
+    Arena(const Arena&)            = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena() {
+        for (auto page : pages_) ::operator delete(page, std::align_val_t(Page_Size));
+    }
+
+    /// @name Allocate/Deallocate
+    ///@{
+    void* allocate(size_t num_bytes) {
+        num_bytes = round(num_bytes);
+        if (auto c = size_class(num_bytes); c < Num_Size_Classes) {
+            if (auto block = free_[c]) {
+                free_[c] = block->next;
+                return block;
+            }
+        }
+
+        if (num_bytes > size_t(end_ - ptr_)) grow(num_bytes);
+        auto res = ptr_;
+        ptr_ += num_bytes;
+        return res;
+    }
+
+    /// Gives @p p back to the Arena; @p num_bytes must match the size of the original allocation.
+    void deallocate(void* p, size_t num_bytes) {
+        num_bytes = round(num_bytes);
+        auto ptr  = static_cast<std::byte*>(p);
+        if (ptr + num_bytes == ptr_) {
+            ptr_ = ptr; // most recent allocation: rewind
+        } else if (auto c = size_class(num_bytes); c < Num_Size_Classes) {
+            auto block = static_cast<Block*>(p);
+            block->next = free_[c];
+            free_[c]    = block;
+        } // else: wasted until the Arena dies
+    }
+    ///@}
+
+    /// The `owner` passed to the constructor of the Arena that allocated @p p.
+    static void* owner(const void* p) {
+        auto page = std::bit_cast<uintptr_t>(p) & ~uintptr_t(Page_Size - 1);
+        return reinterpret_cast<const Header*>(page)->owner;
+    }
+
+    /// @name Stats
+    ///@{
+    size_t num_pages() const { return pages_.size(); }
+    size_t num_bytes() const { return num_bytes_; } ///< Total number of bytes reserved in pages.
+    ///@}
+
+private:
+    struct Block {
+        Block* next;
+    };
+
+    struct Header {
+        void* owner;
+    };
+
+    static constexpr size_t round(size_t n) { return (n + (Align - 1)) & ~(Align - 1); }
+    static constexpr size_t size_class(size_t n) { return n / Align - 1; }
+    static constexpr size_t Header_Size = Align;
+    static_assert(sizeof(Header) <= Header_Size && Header_Size + Max_Size == Page_Size);
+
+    void grow([[maybe_unused]] size_t num_bytes) {
+        // a larger page would need a Header at each Page_Size boundary - right in the middle of the block
+        assert(num_bytes <= Max_Size && "block doesn't fit into a page");
+        auto page = static_cast<std::byte*>(::operator new(Page_Size, std::align_val_t(Page_Size)));
+        new (page) Header{owner_};
+        pages_.emplace_back(page);
+        ptr_ = page + Header_Size;
+        end_ = page + Page_Size;
+        num_bytes_ += Page_Size;
+    }
+
+    void* owner_;
+    size_t num_bytes_ = 0;
+    std::byte* ptr_   = nullptr;
+    std::byte* end_   = nullptr;
+    std::vector<std::byte*> pages_;
+    std::array<Block*, Num_Size_Classes> free_ = {};
+};
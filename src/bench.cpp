@@ -0,0 +1,965 @@
+#include <cassert>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <ranges>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
+
+#ifdef __unix__
+#    include <sys/resource.h>
+#endif
+
+#include "dom.h"
+#include "dot.h"
+#include "gcm.h"
+#include "link_cut_forest.h"
+#include "tape.h"
+#include "world.h"
+
+static constexpr size_t Batch_Size = 64;
+
+static volatile size_t sink; ///< Keeps the compiler from optimizing away the results of the measured ops.
+
+/// Peak resident set size of this process in KiB or `0` if unknown.
+static size_t peak_rss() {
+#ifdef __unix__
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Report
+ */
+
+struct Result {
+    std::string workload;
+    std::string impl;
+    std::string op;
+    size_t ops;
+    double secs;
+    double p50, p90, p99; ///< ns/op
+    size_t peak_rss;      ///< KiB
+    std::vector<std::pair<std::string, double>> extra = {};
+};
+
+class Report {
+public:
+    enum class Format { Text, CSV, JSON };
+
+    Report(Format format)
+        : format_(format) {
+        if (format_ == Format::CSV) std::cout << "workload,impl,op,ops,secs,ops_per_sec,p50_ns,p90_ns,p99_ns,peak_rss_kib,extra\n";
+        if (format_ == Format::JSON) std::cout << "[";
+    }
+    ~Report() {
+        if (format_ == Format::JSON) std::cout << "\n]\n";
+        std::cout << std::flush;
+    }
+
+    void add(const Result& r) {
+        auto ops_per_sec = double(r.ops) / r.secs;
+        switch (format_) {
+            case Format::Text:
+                std::cout << std::left << std::setw(14) << r.workload << std::setw(20) << r.impl << std::setw(16) << r.op;
+                std::cout << ops_per_sec / 1e6 << " Mops/s, ns/op p50 " << r.p50 << " p90 " << r.p90 << " p99 " << r.p99
+                          << ", peak RSS " << r.peak_rss / 1024 << " MiB";
+                for (auto& [key, value] : r.extra) std::cout << ", " << key << ' ' << value;
+                std::cout << std::endl;
+                break;
+            case Format::CSV: {
+                std::cout << r.workload << ',' << r.impl << ',' << r.op << ',' << r.ops << ',' << r.secs << ','
+                          << ops_per_sec << ',' << r.p50 << ',' << r.p90 << ',' << r.p99 << ',' << r.peak_rss << ',';
+                const char* sep = "";
+                for (auto& [key, value] : r.extra) std::cout << sep << key << '=' << value, sep = ";";
+                std::cout << '\n';
+                break;
+            }
+            case Format::JSON:
+                std::cout << (first_ ? "\n" : ",\n") << "  {\"workload\": \"" << r.workload << "\", \"impl\": \"" << r.impl
+                          << "\", \"op\": \"" << r.op << "\", \"ops\": " << r.ops << ", \"secs\": " << r.secs
+                          << ", \"ops_per_sec\": " << ops_per_sec << ", \"p50_ns\": " << r.p50 << ", \"p90_ns\": " << r.p90
+                          << ", \"p99_ns\": " << r.p99 << ", \"peak_rss_kib\": " << r.peak_rss << ", \"extra\": {";
+                for (const char* sep = ""; auto& [key, value] : r.extra) std::cout << sep << '"' << key << "\": " << value, sep = ", ";
+                std::cout << "}}";
+                first_ = false;
+                break;
+        }
+    }
+
+private:
+    Format format_;
+    bool first_ = true;
+};
+
+/// Per-op averages of the hot-path counters that were bumped at all; see stats.h.
+static std::vector<std::pair<std::string, double>> per_op(const stats::Counters& c, size_t ops) {
+    auto avg = [](uint64_t sum, uint64_t n) { return n ? double(sum) / double(n) : 0.0; };
+    std::vector<std::pair<std::string, double>> res;
+    if (c.num_splays != 0) {
+        res.insert(res.end(), {
+            {"splays_per_op", avg(c.num_splays, ops)},
+            {"rotations_per_splay", avg(c.num_rotations, c.num_splays)},
+            {"splay_depth_avg", avg(c.splay_depth, c.num_splays)},
+            {"splay_depth_max", double(c.max_splay_depth)},
+        });
+    }
+    if (c.num_exposes != 0) {
+        res.insert(res.end(), {
+            {"exposes_per_op", avg(c.num_exposes, ops)},
+            {"hops_per_expose", avg(c.num_hops, c.num_exposes)},
+            {"hops_max", double(c.max_hops)},
+        });
+    }
+    if (c.num_root_walks != 0) {
+        res.insert(res.end(), {
+            {"root_walk_avg", avg(c.root_walk, c.num_root_walks)},
+            {"root_walk_max", double(c.max_root_walk)},
+        });
+    }
+    if (c.num_puts != 0) {
+        res.insert(res.end(), {
+            {"put_hit_ratio", avg(c.num_hits, c.num_puts)},
+            {"put_probe_avg", avg(c.probe, c.num_puts)},
+            {"put_probe_max", double(c.max_probe)},
+        });
+    }
+    return res;
+}
+
+/// Result of @p ops that took @p secs in total and @p times ns/op per batch.
+static Result summarize(std::string workload, std::string impl, std::string op, size_t ops, double secs, std::vector<double>& times) {
+    std::ranges::sort(times);
+    auto pct = [&](double p) { return times.empty() ? 0.0 : times[size_t(p * double(times.size() - 1))]; };
+    return Result{std::move(workload), std::move(impl), std::move(op), ops, secs, pct(0.5), pct(0.9), pct(0.99), peak_rss()};
+}
+
+/// Invokes `batch(begin, end)` for consecutive ranges of Batch_Size ops out of @p ops and times each of them.
+/// With `LCEXPR_STATS`, the result also contains the hot-path counters of these ops.
+template<class F>
+static Result measure(std::string workload, std::string impl, std::string op, size_t ops, F batch) {
+    std::vector<double> times;
+    times.reserve(ops / Batch_Size + 1);
+    stats::counters() = {};
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t begin = 0; begin < ops; begin += Batch_Size) {
+        auto end = std::min(begin + Batch_Size, ops);
+        auto t0  = std::chrono::steady_clock::now();
+        batch(begin, end);
+        auto t1 = std::chrono::steady_clock::now();
+        times.emplace_back(std::chrono::duration<double, std::nano>(t1 - t0).count() / double(end - begin));
+    }
+    auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    auto res = summarize(std::move(workload), std::move(impl), std::move(op), ops, secs, times);
+    if constexpr (stats::enabled) res.extra = per_op(stats::counters(), ops);
+    return res;
+}
+
+/// Same as above but calls `f(i)` for each op `i`.
+template<class F>
+static Result measure_each(std::string workload, std::string impl, std::string op, size_t ops, F f) {
+    return measure(std::move(workload), std::move(impl), std::move(op), ops, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i != end; ++i) f(i);
+    });
+}
+
+/// Same as measure_each but spreads the @p ops evenly over @p num_threads threads; thread `t` calls `f(t, i)` for its ops `i`.
+/// The hot-path counters of stats.h are thread-local and hence not reported.
+template<class F>
+static Result measure_parallel(std::string workload, std::string impl, std::string op, size_t ops, size_t num_threads, F f) {
+    std::vector<std::vector<double>> times(num_threads);
+    std::vector<std::thread> threads;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t != num_threads; ++t) {
+        threads.emplace_back([&, t] {
+            auto end = ops * (t + 1) / num_threads;
+            for (auto begin = ops * t / num_threads; begin < end; begin += Batch_Size) {
+                auto batch_end = std::min(begin + Batch_Size, end);
+                auto t0        = std::chrono::steady_clock::now();
+                for (auto i = begin; i != batch_end; ++i) f(t, i);
+                auto t1 = std::chrono::steady_clock::now();
+                times[t].emplace_back(std::chrono::duration<double, std::nano>(t1 - t0).count() / double(batch_end - begin));
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> all;
+    for (auto& ts : times) all.insert(all.end(), ts.begin(), ts.end());
+    return summarize(std::move(workload), std::move(impl), std::move(op), ops, secs, all);
+}
+
+/*
+ * Workload Generators
+ */
+
+/// Generates random `World` constructor calls.
+/// Operands are mostly drawn from the recently created nodes, so a fair amount of calls are duplicates.
+/// The same seed yields the same sequence of calls.
+class RandomDAG {
+public:
+    RandomDAG(World& w, uint64_t seed)
+        : w_(w)
+        , rng_(seed) {
+        for (char c = 'a'; c <= 'z'; ++c) pool_.emplace_back(w.id(c));
+    }
+
+    const Expr* operator()() {
+        const Expr* e;
+        switch (rng_() % 6) {
+            case 0: e = w_.lit(rng_() % 1024); break;
+            case 1: e = w_.add(pick(), pick()); break;
+            case 2: e = w_.sub(pick(), pick()); break;
+            case 3: e = w_.mul(pick(), pick()); break;
+            case 4: e = w_.minus(pick()); break;
+            default: e = w_.select(w_.eq(pick(), pick()), pick(), pick()); break;
+        }
+        pool_.emplace_back(e);
+        return e;
+    }
+
+private:
+    const Expr* pick() {
+        auto window = std::min<size_t>(pool_.size(), 64);
+        return pool_[pool_.size() - 1 - rng_() % window];
+    }
+
+    World& w_;
+    std::mt19937_64 rng_;
+    std::vector<const Expr*> pool_;
+};
+
+/// Issues @p n calls of a RandomDAG.
+static void build_random(World& w, size_t n, uint64_t seed) {
+    RandomDAG dag(w, seed);
+    for (size_t i = 0; i != n; ++i) dag();
+}
+
+/// Random CFG with `n` basic blocks:
+/// each block either jumps to its successor or branches to two random blocks - forwards or backwards.
+class RandomCFG {
+public:
+    RandomCFG(World& w, uint64_t seed)
+        : w_(w)
+        , rng_(seed)
+        , x_(w.id('x'))
+        , ret_(w.id('r')) {}
+
+    void bb() { bbs_.emplace_back(w_.bb()); }
+    const Expr* operator[](size_t i) const { return bbs_[i]; }
+
+    /// Sets the body of the @p i-th block.
+    void body(size_t i) { bbs_[i]->set(make_body(i)); }
+
+    /// Replaces the body of the @p i-th block in place - without maintaining the LinkCutTree of its old and new body.
+    void rewire(size_t i) { bbs_[i]->set_op(0, make_body(i)); }
+
+private:
+    const Expr* make_body(size_t i) {
+        auto n = bbs_.size();
+        if (i + 1 == n) return w_.jmp(ret_, x_);
+        if (rng_() % 3 == 0) return w_.jmp(bbs_[i + 1], w_.add(x_, w_.lit(i)));
+        return w_.br(w_.eq(x_, w_.lit(i)), bbs_[rng_() % n], bbs_[rng_() % n]);
+    }
+
+    World& w_;
+    std::mt19937_64 rng_;
+    const Expr* x_;
+    const Expr* ret_;
+    std::vector<Expr*> bbs_;
+};
+
+/// Random forest of `n` nodes: node `i` goes below a random earlier node;
+/// if `deep`, that node is one of the 8 previous ones, which yields long paths.
+struct RandomForest {
+    size_t parent(size_t i) { return deep ? i - 1 - rng() % std::min<size_t>(i, 8) : rng() % i; }
+
+    bool deep;
+    std::mt19937_64 rng;
+};
+
+/// Baseline for LinkCutTree: plain parent pointers.
+/// LinkCutTree::link and LinkCutTree::cut are O(1), but LinkCutTree::root and LinkCutTree::lca walk up in O(depth).
+class NaiveForest {
+public:
+    using Node                = uint32_t;
+    static constexpr Node Nil = Node(-1);
+
+    NaiveForest(size_t n)
+        : parent_(n, Nil)
+        , mark_(n, 0) {}
+
+    void link(Node x, Node child) { parent_[child] = x; }
+    void cut(Node x) { parent_[x] = Nil; }
+
+    Node root(Node x) const {
+        while (parent_[x] != Nil) x = parent_[x];
+        return x;
+    }
+
+    Node lca(Node a, Node b) {
+        ++stamp_;
+        for (auto x = a; x != Nil; x = parent_[x]) mark_[x] = stamp_;
+        for (auto x = b; x != Nil; x = parent_[x])
+            if (mark_[x] == stamp_) return x;
+        return Nil;
+    }
+
+private:
+    std::vector<Node> parent_;
+    std::vector<uint32_t> mark_;
+    uint32_t stamp_ = 0;
+};
+
+/*
+ * Workloads
+ */
+
+/// Builds a random DAG from scratch and then replays the same calls, so they only hit duplicates.
+static void bench_dag(Report& report, size_t n, uint64_t seed) {
+    World w;
+    RandomDAG dag(w, seed);
+    auto r = measure_each("dag", "World", "build", n, [&](size_t) { dag(); });
+
+    auto num_nodes = double(w.shard(0).set.size());
+    auto stats     = w.shard(0).set.stats();
+    r.extra.insert(r.extra.begin(), {
+        {"nodes", num_nodes},
+        {"arena_bytes_per_node", double(w.shard(0).arena.num_bytes()) / num_nodes},
+        {"table_bytes_per_node", double(stats.num_bytes) / num_nodes},
+        {"table_avg_probe", stats.avg_probe},
+        {"table_max_probe", double(stats.max_probe)},
+    });
+    report.add(r);
+
+    RandomDAG replay(w, seed);
+    report.add(measure_each("dag", "World", "cse", n, [&](size_t) { replay(); }));
+    assert(w.shard(0).set.size() == size_t(num_nodes));
+}
+
+/// Builds a chain of @p n unary ops.
+static void bench_chain(Report& report, size_t n, uint64_t) {
+    World w;
+    auto e = w.id('x');
+    report.add(measure_each("chain", "World", "build", n, [&](size_t) { e = w.minus(e); }));
+}
+
+/// Builds a RandomCFG with @p n blocks and its DomTree, queries nearest common dominators of random blocks,
+/// and then rewires random blocks while updating the DomTree incrementally - timing inserted and removed edges apart.
+static void bench_cfg(Report& report, size_t n, uint64_t seed) {
+    World w;
+    RandomCFG cfg(w, seed);
+    report.add(measure_each("cfg", "World", "bb", n, [&](size_t) { cfg.bb(); }));
+    report.add(measure_each("cfg", "World", "body", n, [&](size_t i) { cfg.body(i); }));
+
+    std::optional<DomTree> dom;
+    auto r = measure("cfg", "DomTree", "build", 1, [&](size_t, size_t) { dom.emplace(cfg[0]); });
+    r.extra.insert(r.extra.begin(), {
+        {"blocks", double(dom->size())},
+        {"ns_per_block", r.secs * 1e9 / double(dom->size())},
+    });
+    report.add(r);
+
+    std::vector<const Expr*> bbs;
+    for (size_t i = 0; i != n; ++i)
+        if (dom->is_reachable(cfg[i])) bbs.emplace_back(cfg[i]);
+    std::mt19937_64 rng(seed);
+    report.add(measure_each("cfg", "DomTree", "lca", n, [&](size_t) {
+        sink = sink + dom->lca(bbs[rng() % bbs.size()], bbs[rng() % bbs.size()])->gid;
+    }));
+
+    // like DomTree::update but timing the insertions and removals of each edit separately, per edge
+    std::vector<double> times[2];
+    double secs[2]    = {};
+    size_t num_ops[2] = {};
+    auto time = [&](size_t k, auto&& edges, auto f) {
+        if (edges.empty()) return;
+        auto t0 = std::chrono::steady_clock::now();
+        for (auto s : edges) f(s);
+        auto dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        times[k].emplace_back(dt * 1e9 / double(edges.size()));
+        secs[k] += dt;
+        num_ops[k] += edges.size();
+    };
+    for (size_t k = 0; k != Batch_Size; ++k) {
+        auto i   = rng() % n;
+        auto old = DomTree::succs(cfg[i]);
+        cfg.rewire(i);
+        auto now  = DomTree::succs(cfg[i]);
+        auto gone = [&](const auto& a, const auto& b) {
+            std::vector<const Expr*> res;
+            for (auto s : a)
+                if (std::ranges::find(b, s) == b.end()) res.emplace_back(s);
+            return res;
+        };
+        time(0, gone(now, old), [&](const Expr* s) { dom->insert_edge(cfg[i], s); });
+        time(1, gone(old, now), [&](const Expr* s) { dom->remove_edge(cfg[i], s); });
+    }
+    report.add(summarize("cfg", "DomTree", "insert_edge", num_ops[0], secs[0], times[0]));
+    report.add(summarize("cfg", "DomTree", "remove_edge", num_ops[1], secs[1], times[1]));
+    report.add(measure("cfg", "DomTree", "rebuild", 1, [&](size_t, size_t) { dom.emplace(cfg[0]); }));
+}
+
+/// Issues @p n RandomDAG calls into one concurrent World from 1, 2, 4, ... threads up to the number of cores.
+/// Each thread has its own RandomDAG, so the threads only share leaves and small Expr%s built from them.
+/// The single-threaded World does the same calls as the concurrent one on a single thread.
+static void bench_world_mt(Report& report, size_t n, uint64_t seed) {
+    static constexpr size_t Num_Shards = 64;
+    auto num_cores = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    std::vector<size_t> num_threads;
+    for (size_t t = 1; t < num_cores; t *= 2) num_threads.emplace_back(t);
+    num_threads.emplace_back(num_cores);
+
+    {
+        World w;
+        RandomDAG dag(w, seed);
+        auto r = measure_each("world-mt", "World", "put", n, [&](size_t) { dag(); });
+        r.extra.insert(r.extra.begin(), {{"threads", 1.0}, {"nodes", double(w.gid)}});
+        report.add(r);
+    }
+
+    for (auto t : num_threads) {
+        World w(Num_Shards);
+        std::vector<RandomDAG> dags;
+        for (size_t i = 0; i != t; ++i) dags.emplace_back(w, seed + i);
+
+        auto impl = "World(" + std::to_string(Num_Shards) + ")";
+        auto r    = measure_parallel("world-mt", impl, "put", n, t, [&](size_t i, size_t) { dags[i](); });
+        r.extra.insert(r.extra.begin(), {{"threads", double(t)}, {"nodes", double(w.gid)}});
+        report.add(r);
+
+        report.add(measure("world-mt", impl, "link", 1, [&](size_t, size_t) { w.link(); }));
+    }
+}
+
+/// Runs GCM on random CFGs of @p n / 16, @p n / 4, and @p n BB%s;
+/// for O(n log n) scaling, `ns_per_block_log` stays flat while `ns_per_block` grows slowly.
+static void bench_gcm(Report& report, size_t n, uint64_t seed) {
+    for (auto size : {std::max<size_t>(n / 16, 2), std::max<size_t>(n / 4, 2), n}) {
+        World w;
+        RandomCFG cfg(w, seed);
+        for (size_t i = 0; i != size; ++i) cfg.bb();
+        for (size_t i = 0; i != size; ++i) cfg.body(i);
+        DomTree dom(cfg[0]);
+
+        std::optional<GCM> gcm;
+        auto r      = measure("gcm", "GCM", "run-" + std::to_string(size), 1, [&](size_t, size_t) { gcm.emplace(dom); });
+        auto blocks = double(dom.size());
+        r.extra.insert(r.extra.begin(), {
+            {"blocks", blocks},
+            {"exprs", double(gcm->size())},
+            {"ns_per_block", r.secs * 1e9 / blocks},
+            {"ns_per_block_log", r.secs * 1e9 / (blocks * std::log2(blocks))},
+        });
+        report.add(r);
+    }
+}
+
+/// Dumps a chain of @p n binary ops - each with a fresh literal - with DotWriter into a sink that discards everything.
+static void bench_dot(Report& report, size_t n, uint64_t) {
+    struct Discard : std::streambuf {
+        int overflow(int c) override { return c; }
+        std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+    } discard;
+    std::ostream os(&discard);
+
+    World w;
+    auto e = w.id('x');
+    for (size_t i = 0; i != n; ++i) e = w.add(e, w.lit(i + 1));
+
+    using View   = DotWriter::View;
+    auto nodes   = double(w.gid);
+    auto configs = {
+        std::tuple("both", View::Both, DotWriter::Limits()),
+        std::tuple("rep", View::Rep, DotWriter::Limits()),
+        std::tuple("aux", View::Aux, DotWriter::Limits()),
+        std::tuple("rep-1000", View::Rep, DotWriter::Limits{.max_nodes = 1000}),
+    };
+    for (auto [op, view, limits] : configs) {
+        DotWriter dot(view, limits);
+        auto r = measure("dot", "DotWriter", op, 1, [&](size_t, size_t) { dot.write(os, e); });
+        r.extra.insert(r.extra.begin(), {{"nodes", nodes}, {"ns_per_node", r.secs * 1e9 / nodes}});
+        report.add(r);
+    }
+}
+
+/// Builds a random DAG, saves it, and compares rebuilding it call by call against World::load with and without the *aux* part.
+static void bench_snapshot(Report& report, size_t n, uint64_t seed) {
+    auto file = (std::filesystem::temp_directory_path() / "lcexpr_bench.snapshot").string();
+    World w;
+    build_random(w, n, seed);
+    auto nodes = double(w.gid);
+
+    auto add = [&](Result r) {
+        r.extra.insert(r.extra.begin(), {{"nodes", nodes}, {"ns_per_node", r.secs * 1e9 / nodes}});
+        report.add(r);
+    };
+
+    add(measure("snapshot", "World", "rebuild", 1, [&](size_t, size_t) {
+        World l;
+        build_random(l, n, seed);
+    }));
+    for (auto aux : {false, true}) {
+        auto suffix = aux ? "+aux" : "";
+        add(measure("snapshot", "World", std::string("save") + suffix, 1, [&](size_t, size_t) { w.save(file, aux); }));
+        add(measure("snapshot", "World", std::string("load") + suffix, 1, [&](size_t, size_t) {
+            World l;
+            sink = l.load(file).size();
+        }));
+    }
+    std::filesystem::remove(file);
+}
+
+/// Replaces random Expr%s among the topmost ones of a random DAG of @p n calls with fresh literals:
+/// compares World::replace_all_uses_with - which rehashes everything above - against merely finding the direct users
+/// by scanning the hash-consing table.
+static void bench_rauw(Report& report, size_t n, uint64_t seed) {
+    static constexpr size_t Top = 4096; ///< Candidates with the largest gids.
+
+    World w;
+    build_random(w, n, seed);
+    std::vector<const Expr*> exprs;
+    for (auto e : w.shard(0).set)
+        if (!e->uses().empty()) exprs.emplace_back(e);
+    std::ranges::sort(exprs, GIDLt<const Expr*>());
+    exprs.erase(exprs.begin(), exprs.end() - std::min(exprs.size(), Top));
+
+    std::mt19937_64 rng(seed);
+    auto ops = std::min(std::max<size_t>(n / 16, 1), Top);
+    std::vector<const Expr*> olds;
+    for (size_t i = 0; i != ops; ++i) olds.emplace_back(exprs[rng() % exprs.size()]);
+
+    size_t uses = 0, nodes = w.shard(0).set.size();
+    auto r = measure_each("rauw", "World", "replace", ops, [&](size_t i) {
+        uses += olds[i]->num_uses();
+        w.replace_all_uses_with(olds[i], w.lit(uint64_t(-1) - i));
+    });
+    r.extra.insert(r.extra.begin(), {{"nodes", double(nodes)}, {"uses_per_op", double(uses) / double(ops)}});
+    report.add(r);
+
+    report.add(measure_each("rauw", "scan", "find_users", std::min<size_t>(ops, 64), [&](size_t i) {
+        size_t num = 0;
+        for (auto e : w.shard(0).set) num += std::ranges::count(e->ops(), olds[i]);
+        sink = num;
+    }));
+}
+
+/// Speculative rewrites on a random DAG of @p n calls: each op hangs a random Expr below a new `e + i` and queries
+/// the new root, then undoes this again - either via World::rollback or by hand with the inverse LinkCutTree::cut and
+/// LinkCutTree::link, which splays once more and leaves the new Expr%s behind in the hash-consing table.
+static void bench_speculate(Report& report, size_t n, uint64_t seed) {
+    static constexpr size_t Num_Rewrites = 4; ///< Per op.
+
+    for (auto rollback : {true, false}) {
+        World w;
+        build_random(w, n, seed);
+        std::vector<const Expr*> exprs;
+        for (auto e : w.shard(0).set)
+            if (!e->mut) exprs.emplace_back(e);
+        std::ranges::sort(exprs, GIDLt<const Expr*>());
+        std::mt19937_64 rng(seed);
+
+        auto r = measure_each("speculate", "World", rollback ? "rollback" : "inverse", n / Num_Rewrites, [&](size_t i) {
+            std::array<std::pair<const Expr*, const Expr*>, Num_Rewrites> undo; // Expr + old rep parent
+            if (rollback) w.checkpoint();
+            for (auto& [e, parent] : undo) {
+                e      = exprs[rng() % exprs.size()];
+                parent = e->parent();
+                e->cut();
+                sink = sink + w.add(e, w.lit(i))->root()->gid;
+            }
+            if (rollback) {
+                w.rollback();
+            } else {
+                for (auto [e, parent] : undo | std::views::reverse) {
+                    e->cut();
+                    if (parent) parent->link(e);
+                }
+            }
+        });
+        r.extra.insert(r.extra.begin(), {{"rewrites_per_op", double(Num_Rewrites)}, {"nodes_after", double(w.gid)}});
+        report.add(r);
+    }
+}
+
+/// Random postfix program of @p n World::Instr%s over the pure Tag%s that leaves a single Expr on the stack.
+static std::vector<World::Instr> random_program(size_t n, uint64_t seed) {
+    static constexpr Tag Ops[] = {Tag::Minus, Tag::Add, Tag::Sub, Tag::Mul, Tag::Eq, Tag::Select};
+    std::mt19937_64 rng(seed);
+    std::vector<World::Instr> prog;
+    size_t depth = 0;
+    auto apply   = [&](Tag tag) {
+        prog.emplace_back(tag);
+        depth -= arity(tag) - 1;
+    };
+
+    while (prog.size() < n) {
+        if (depth < 3 || rng() % 2 == 0) {
+            prog.emplace_back(rng() % 2 ? World::Instr{Tag::Lit, rng() % 1024} : World::Instr{Tag::Id, 'a' + rng() % 26});
+            ++depth;
+        } else {
+            apply(Ops[rng() % std::size(Ops)]);
+        }
+    }
+    while (depth > 1) apply(Tag::Mul);
+    return prog;
+}
+
+/// Builds a random postfix program of @p n World::Instr%s: World::build against one World::put per Instr.
+static void bench_build(Report& report, size_t n, uint64_t seed) {
+    auto prog = random_program(n, seed);
+    auto add  = [&](Result r, const World& w) {
+        r.extra.insert(r.extra.begin(), {{"instrs", double(prog.size())},
+                                         {"nodes", double(w.gid)},
+                                         {"ns_per_instr", r.secs * 1e9 / double(prog.size())}});
+        report.add(r);
+    };
+
+    {
+        World w;
+        std::vector<const Expr*> stack;
+        add(measure("build", "World", "put", 1, [&](size_t, size_t) {
+                for (auto [tag, stuff] : prog) {
+                    auto pop = [&]() {
+                        auto e = stack.back();
+                        stack.pop_back();
+                        return e;
+                    };
+                    const Expr* e;
+                    if (tag == Tag::Lit) {
+                        e = w.lit(stuff);
+                    } else if (tag == Tag::Id) {
+                        e = w.id(char(stuff));
+                    } else if (tag == Tag::Minus) {
+                        e = w.minus(pop());
+                    } else if (tag == Tag::Select) {
+                        auto f = pop(), t = pop();
+                        e      = w.select(pop(), t, f);
+                    } else {
+                        auto b = pop(), a = pop();
+                        // clang-format off
+                        switch (tag) {
+                            case Tag::Add: e = w.add(a, b); break;
+                            case Tag::Sub: e = w.sub(a, b); break;
+                            case Tag::Mul: e = w.mul(a, b); break;
+                            default:       e = w.eq(a, b);  break;
+                        }
+                        // clang-format on
+                    }
+                    stack.emplace_back(e);
+                }
+            }),
+            w);
+    }
+    {
+        World w;
+        add(measure("build", "World", "build", 1, [&](size_t, size_t) { sink = w.build(prog).size(); }), w);
+    }
+}
+
+/// Evaluates the last Expr of a random DAG of @p n calls for Tape::Lanes bindings at a time:
+/// compares Tape::eval against a per-binding interpreter that walks the same Expr%s in post-order.
+static void bench_tape(Report& report, size_t n, uint64_t seed) {
+    World w;
+    RandomDAG dag(w, seed);
+    const Expr* root = nullptr;
+    for (size_t i = 0; i != std::min<size_t>(n, 1024); ++i) root = dag();
+
+    auto tape = Tape::compile(root);
+    std::mt19937_64 rng(seed);
+    std::vector<std::vector<uint64_t>> columns(tape.ids().size(), std::vector<uint64_t>(Tape::Lanes));
+    std::vector<const uint64_t*> inputs;
+    for (auto& column : columns) {
+        for (auto& u : column) u = rng() % 4; // small values, so Tag::Eq is sometimes true
+        inputs.emplace_back(column.data());
+    }
+    std::vector<uint64_t> out(Tape::Lanes), ref(Tape::Lanes);
+
+    // interpreter: post-order with operand indices; Tag::Id refers to its column
+    std::vector<std::tuple<Tag, uint64_t, std::array<uint32_t, 3>>> code;
+    ExprMap<uint32_t> index;
+    auto lower = [&](auto& self, const Expr* e) -> uint32_t {
+        if (auto i = index.find(e); i != index.end()) return i->second;
+        std::array<uint32_t, 3> ops = {};
+        for (size_t i = 0; i != e->num_ops; ++i) ops[i] = self(self, e->op(i));
+        auto stuff = e->stuff;
+        if (e->tag == Tag::Id) stuff = std::ranges::find(tape.ids(), char(e->stuff)) - tape.ids().begin();
+        code.emplace_back(e->tag, stuff, ops);
+        return index[e] = uint32_t(code.size() - 1);
+    };
+    lower(lower, root);
+
+    std::vector<uint64_t> vals(code.size());
+    auto interpret = [&](size_t k) {
+        for (size_t i = 0; i != code.size(); ++i) {
+            auto& [tag, stuff, ops] = code[i];
+            auto a = vals[ops[0]], b = vals[ops[1]], c = vals[ops[2]];
+            switch (tag) {
+                case Tag::Lit: vals[i] = stuff; break;
+                case Tag::Id: vals[i] = inputs[stuff][k]; break;
+                case Tag::Minus: vals[i] = 0 - a; break;
+                case Tag::Plus: vals[i] = a; break;
+                case Tag::Add: vals[i] = a + b; break;
+                case Tag::Sub: vals[i] = a - b; break;
+                case Tag::Mul: vals[i] = a * b; break;
+                case Tag::Eq: vals[i] = a == b; break;
+                case Tag::Select: vals[i] = a ? b : c; break;
+                default: break;
+            }
+        }
+        return vals.back();
+    };
+
+    auto bindings = double(Tape::Lanes);
+    auto rounds   = std::max<size_t>(n / Tape::Lanes, 1);
+    auto add      = [&](Result r) {
+        auto secs = r.secs / double(rounds);
+        r.extra.insert(r.extra.begin(), {{"exprs", double(code.size())},
+                                         {"instrs", double(tape.instrs().size())},
+                                         {"regs", double(tape.num_regs())},
+                                         {"ns_per_binding", secs * 1e9 / bindings}});
+        report.add(r);
+    };
+    add(measure_each("tape", "Interpreter", "eval", rounds, [&](size_t) {
+        for (size_t k = 0; k != Tape::Lanes; ++k) ref[k] = interpret(k);
+    }));
+    add(measure_each("tape", "Tape", "eval", rounds, [&](size_t) { tape.eval(inputs, out.data(), Tape::Lanes); }));
+    if (out != ref) std::cerr << "tape: Tape and Interpreter disagree" << std::endl;
+}
+
+/// Inserts half of the nodes of a random DAG and then looks up all of them in ExprSet and the `std::unordered_set` it replaced.
+static void bench_table(Report& report, size_t n, uint64_t seed) {
+    World w;
+    build_random(w, n, seed);
+
+    std::vector<const Expr*> exprs(w.shard(0).set.begin(), w.shard(0).set.end());
+    std::ranges::shuffle(exprs, std::mt19937_64(seed));
+    auto half = exprs.size() / 2;
+
+    auto run = [&](const char* name, auto set) {
+        report.add(measure_each("table", name, "insert", half, [&](size_t i) { set.emplace(exprs[i]); }));
+        report.add(measure_each("table", name, "count", exprs.size(), [&](size_t i) { sink = sink + set.count(exprs[i]); }));
+    };
+
+    struct OldGIDHash {
+        size_t operator()(const Expr* e) const { return e->gid; }
+    };
+    run("ExprSet", ExprSet());
+    run("std::unordered_set", std::unordered_set<const Expr*, OldGIDHash, GIDEq<const Expr*>>());
+}
+
+/// Runs the same RandomForest workload on LinkCutTree, LinkCutForest, and NaiveForest:
+/// * link: builds the forest;
+/// * lca: an LCA query storm, issued one by one and - for LinkCutTree - via LinkCutTree::lca_many, too;
+/// * churn: cuts random nodes and links them below a random node outside of their subtree.
+///
+/// NaiveForest takes O(depth) per query; in a deep forest, it only runs every 256th query.
+static void bench_forest(Report& report, size_t n, uint64_t seed, bool deep) {
+    struct Node : public LinkCutTree<Node> {};
+    auto workload = deep ? "forest-deep" : "forest-random";
+
+    auto run = [&](const char* impl, size_t div, auto link, auto cut, auto root, auto lca) {
+        RandomForest forest{deep, std::mt19937_64(seed)};
+        report.add(measure_each(workload, impl, "link", n - 1, [&](size_t i) { link(forest.parent(i + 1), i + 1); }));
+
+        std::vector<std::pair<size_t, size_t>> queries(n / div);
+        for (auto& [a, b] : queries) a = forest.rng() % n, b = forest.rng() % n;
+        report.add(measure_each(workload, impl, "lca", queries.size(), [&](size_t i) {
+            sink = sink + lca(queries[i].first, queries[i].second);
+        }));
+
+        report.add(measure_each(workload, impl, "churn", n / 4 / div, [&](size_t) {
+            auto x = 1 + forest.rng() % (n - 1);
+            auto y = forest.rng() % n;
+            cut(x);
+            link(root(y) == x ? 0 : y, x); // avoid cycles
+        }));
+    };
+
+    {
+        std::vector<Node> nodes(n);
+        auto ptr = [&](size_t i) { return &nodes[i]; };
+        auto idx = [&](const Node* node) { return node ? size_t(node - nodes.data()) : 0; };
+        run(
+            "LinkCutTree", 1, [&](size_t p, size_t c) { ptr(p)->link(ptr(c)); }, [&](size_t x) { ptr(x)->cut(); },
+            [&](size_t x) { return idx(ptr(x)->root()); }, [&](size_t a, size_t b) { return idx(ptr(a)->lca(ptr(b))); });
+
+        std::mt19937_64 rng(seed);
+        std::vector<std::pair<const Node*, const Node*>> queries(n);
+        for (auto& [a, b] : queries) a = ptr(rng() % n), b = ptr(rng() % n);
+        report.add(measure(workload, "LinkCutTree", "lca_many", n, [&](size_t begin, size_t end) {
+            auto res = Node::lca_many(std::span(queries).subspan(begin, end - begin));
+            sink     = sink + res.size();
+        }));
+    }
+
+    LinkCutForest lcf(n);
+    run(
+        "LinkCutForest", 1, [&](size_t p, size_t c) { lcf.link(uint32_t(p), uint32_t(c)); },
+        [&](size_t x) { lcf.cut(uint32_t(x)); }, [&](size_t x) { return size_t(lcf.root(uint32_t(x))); },
+        [&](size_t a, size_t b) { return size_t(lcf.lca(uint32_t(a), uint32_t(b))); });
+
+    NaiveForest naive(n);
+    run(
+        "naive", deep ? 256 : 1, [&](size_t p, size_t c) { naive.link(uint32_t(p), uint32_t(c)); },
+        [&](size_t x) { naive.cut(uint32_t(x)); }, [&](size_t x) { return size_t(naive.root(uint32_t(x))); },
+        [&](size_t a, size_t b) { return size_t(naive.lca(uint32_t(a), uint32_t(b))); });
+}
+
+/// Replays the *aux* links World makes for an Expr graph on LinkCutTree nodes with either Splaying variant
+/// and times them as well as random lca and path_aggregate queries afterwards.
+/// With agg::SubtreeSum, it also times subtree_aggregate queries against a DFS over the *rep* tree.
+/// The graphs are
+/// * path: a chain of @p n unary ops,
+/// * star: @p n uses of the same node, summed up pairwise,
+/// * random: see build_random.
+static void bench_splay(Report& report, size_t n, uint64_t seed) {
+    auto graph = [&](const char* workload, auto build) {
+        World w;
+        build(w);
+        std::vector<const Expr*> exprs(w.shard(0).set.begin(), w.shard(0).set.end());
+        std::ranges::sort(exprs, GIDLt<const Expr*>());
+
+        auto run = [&]<class M, Splaying Sp>(const char* impl) {
+            struct Node : public LinkCutTree<Node, M, Sp> {};
+            std::vector<Node> nodes(w.gid);
+            std::mt19937_64 rng(seed);
+            auto rnd = [&]() { return &nodes[rng() % nodes.size()]; };
+
+            report.add(measure_each(workload, impl, "link", exprs.size(), [&](size_t i) {
+                for (auto op : exprs[i]->ops()) nodes[exprs[i]->gid].link(&nodes[op->gid]);
+            }));
+            report.add(measure_each(workload, impl, "lca", n, [&](size_t) { sink = sink + (rnd()->lca(rnd()) != nullptr); }));
+            report.add(measure_each(workload, impl, "path_aggregate", n, [&](size_t) {
+                sink = sink + rnd()->path_aggregate().size;
+            }));
+            if constexpr (Node::has_sub) {
+                report.add(measure_each(workload, impl, "subtree_aggregate", n, [&](size_t) {
+                    sink = sink + rnd()->subtree_aggregate().size;
+                }));
+            }
+        };
+        using Sum        = agg::Sum<int32_t, int64_t>;
+        using SubtreeSum = agg::SubtreeSum<int32_t, int64_t>;
+        run.template operator()<Sum, Splaying::BottomUp>("bottom-up");
+        run.template operator()<Sum, Splaying::TopDown>("top-down");
+        run.template operator()<SubtreeSum, Splaying::BottomUp>("bottom-up+subtree");
+
+        // baseline: the same rep tree - each Expr goes below its first user - with explicit child lists
+        std::vector<uint32_t> parent(w.gid, uint32_t(-1));
+        std::vector<std::vector<uint32_t>> children(w.gid);
+        for (auto e : exprs)
+            for (auto op : e->ops())
+                if (parent[op->gid] == uint32_t(-1)) children[parent[op->gid] = e->gid].emplace_back(op->gid);
+
+        std::mt19937_64 rng(seed);
+        std::vector<uint32_t> stack;
+        report.add(measure_each(workload, "DFS", "subtree_aggregate", std::min<size_t>(n, 256), [&](size_t) {
+            size_t size = 0;
+            stack.assign(1, uint32_t(rng() % w.gid));
+            while (!stack.empty()) {
+                auto x = stack.back();
+                stack.pop_back();
+                ++size;
+                stack.insert(stack.end(), children[x].begin(), children[x].end());
+            }
+            sink = sink + size;
+        }));
+    };
+
+    graph("expr-path", [&](World& w) {
+        auto e = w.id('x');
+        for (size_t i = 1; i != n; ++i) e = w.minus(e);
+    });
+    graph("expr-star", [&](World& w) {
+        auto x = w.id('x');
+        std::vector<const Expr*> level;
+        for (size_t i = 0; i != n; ++i) level.emplace_back(w.mul(x, w.lit(i)));
+        while (level.size() > 1) {
+            std::vector<const Expr*> next;
+            for (size_t i = 0; i + 1 < level.size(); i += 2) next.emplace_back(w.add(level[i], level[i + 1]));
+            if (level.size() % 2 != 0) next.emplace_back(level.back());
+            level.swap(next);
+        }
+    });
+    graph("expr-random", [&](World& w) { build_random(w, n, seed); });
+}
+
+/// Benchmark suite for World construction and LinkCutTree operations:
+/// ```
+/// lcexpr_bench [-n <size>] [-s <seed>] [--text|--csv|--json] [<filter>]
+/// ```
+/// * All workloads are generated from `<seed>`, so two runs with the same arguments do the very same work.
+/// * Only workloads whose name contains `<filter>` run.
+///     Peak RSS is that of the whole process so far - run a single workload per process to attribute it.
+/// * Each row reports ops/sec and ns/op percentiles; the percentiles are taken over batches of Batch_Size ops,
+///     as timing each op individually would mostly measure the clock.
+/// * Built with the CMake option `LCEXPR_STATS`, each row also carries the hot-path counters of stats.h per op.
+int main(int argc, char** argv) {
+    size_t n      = 1'000'000;
+    uint64_t seed = 0;
+    auto format   = Report::Format::Text;
+    std::string filter;
+
+    for (int i = 1; i != argc; ++i) {
+        auto arg = std::string(argv[i]);
+        if (arg == "-n" && i + 1 != argc) {
+            n = std::stoull(argv[++i]);
+        } else if (arg == "-s" && i + 1 != argc) {
+            seed = std::stoull(argv[++i]);
+        } else if (arg == "--text") {
+            format = Report::Format::Text;
+        } else if (arg == "--csv") {
+            format = Report::Format::CSV;
+        } else if (arg == "--json") {
+            format = Report::Format::JSON;
+        } else if (arg[0] != '-') {
+            filter = arg;
+        } else {
+            std::cerr << "usage: " << argv[0] << " [-n <size>] [-s <seed>] [--text|--csv|--json] [<filter>]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (n < 2) n = 2;
+
+    using Workload = void (*)(Report&, size_t, uint64_t);
+    static const std::pair<const char*, Workload> workloads[] = {
+        {"dag", bench_dag},
+        {"chain", bench_chain},
+        {"cfg", bench_cfg},
+        {"table", bench_table},
+        {"world-mt", bench_world_mt},
+        {"gcm", bench_gcm},
+        {"dot", bench_dot},
+        {"snapshot", bench_snapshot},
+        {"build", bench_build},
+        {"rauw", bench_rauw},
+        {"speculate", bench_speculate},
+        {"tape", bench_tape},
+        {"forest-random", [](Report& r, size_t n, uint64_t seed) { bench_forest(r, n, seed, false); }},
+        {"forest-deep", [](Report& r, size_t n, uint64_t seed) { bench_forest(r, n, seed, true); }},
+        {"expr", bench_splay},
+    };
+
+    Report report(format);
+    for (auto [name, workload] : workloads)
+        if (std::string(name).find(filter) != std::string::npos) workload(report, n, seed);
+}
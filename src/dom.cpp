@@ -0,0 +1,612 @@
+#include "dom.h"
+
+#include <algorithm>
+#include <numeric>
+#include <queue>
+#include <ranges>
+
+#include "world.h"
+
+/// Walks the body of @p bb and invokes @p f on each BB it reaches without passing through another BB.
+/// @p visit returns `true` the first time it sees an Expr; @p stack is scratch space.
+template<class Visit, class F>
+static void for_each_succ(const Expr* bb, std::vector<const Expr*>& stack, Visit visit, F f) {
+    stack.clear();
+    if (auto body = bb->op(0)) stack.emplace_back(body);
+
+    while (!stack.empty()) {
+        auto e = stack.back();
+        stack.pop_back();
+        if (!visit(e)) continue;
+
+        if (e->tag == Tag::BB) {
+            f(e);
+        } else {
+            auto ops = e->ops();
+            for (auto i = ops.rbegin(), end = ops.rend(); i != end; ++i)
+                if (*i) stack.emplace_back(*i);
+        }
+    }
+}
+
+std::vector<const Expr*> DomTree::succs(const Expr* bb) {
+    ExprSet done;
+    std::vector<const Expr*> stack, res;
+    for_each_succ(bb, stack, [&](const Expr* e) { return done.emplace(e).second; }, [&](const Expr* s) { res.emplace_back(s); });
+    return res;
+}
+
+DomTree::DomTree(const Expr* entry, bool verified)
+    : verified_(verified) {
+    assert(entry->tag == Tag::BB);
+    std::vector<std::pair<Index, Index>> external;
+    attach(discover(entry, external), Nil);
+    assert(external.empty());
+}
+
+/*
+ * Getters & Queries
+ */
+
+const Expr* DomTree::idom(const Expr* bb) const {
+    auto i = index(bb);
+    assert(i != Nil && "BB is not reachable from entry");
+    auto d = nodes_[i].idom;
+    return d == Nil ? nullptr : nodes_[d].bb;
+}
+
+DomTree::Index DomTree::lca(Index a, Index b) const {
+    assert(a != Nil && b != Nil && "BB is not reachable from entry");
+    auto l = nodes_[a].lca(&nodes_[b]);
+    assert(l && "all reachable BBs share the same dominator tree");
+    return index(l->bb);
+}
+
+bool DomTree::verify() const {
+    DomTree ref(entry());
+    if (ref.size() != size()) return false;
+
+    std::vector<const Expr*> expected, actual;
+    for (const auto& n : ref.nodes_) {
+        auto i = index(n.bb);
+        if (i == Nil) return false;
+        if (auto d = n.idom == Nil ? Nil : index(ref.nodes_[n.idom].bb); nodes_[i].idom != d) return false;
+        if (depth(i) != ref.depth(n.bb)) return false;
+
+        auto bbs = [](const DomTree& dom, const Node& n, std::vector<const Expr*>& res) {
+            res.clear();
+            for (auto s : n.succs) res.emplace_back(dom.nodes_[s].bb);
+            std::ranges::sort(res, GIDLt<const Expr*>());
+        };
+        bbs(ref, n, expected);
+        bbs(*this, nodes_[i], actual);
+        if (expected != actual) return false;
+    }
+    return true;
+}
+
+/*
+ * Incremental Updates
+ */
+
+void DomTree::update(const Expr* bb) {
+    auto x = index(bb);
+    if (x == Nil) return;
+
+    auto now = succs(bb);
+    std::vector<const Expr*> removed;
+    for (auto s : nodes_[x].succs)
+        if (std::ranges::find(now, nodes_[s].bb) == now.end()) removed.emplace_back(nodes_[s].bb);
+
+    // insert first: this way, fewer BBs become unreachable in between
+    for (auto s : now) insert_edge(bb, s);
+    for (auto s : removed) remove_edge(bb, s);
+    assert(!verified_ || verify());
+}
+
+void DomTree::insert_edge(const Expr* from, const Expr* to) {
+    auto x = index(from);
+    if (x == Nil) return;
+
+    if (auto y = index(to); y != Nil) {
+        if (std::ranges::find(nodes_[x].succs, y) != nodes_[x].succs.end()) return;
+        nodes_[x].succs.emplace_back(y);
+        nodes_[y].preds.emplace_back(x);
+        insert_reachable(x, y);
+    } else {
+        // to and all BBs behind it that were unreachable so far can only be entered via from -> to
+        std::vector<std::pair<Index, Index>> external;
+        auto region = discover(to, external);
+        y           = region.order.front();
+        nodes_[x].succs.emplace_back(y);
+        nodes_[y].preds.emplace_back(x);
+        attach(region, x);
+
+        // edges from the new BBs back into the old ones are ordinary insertions
+        for (auto [u, v] : external) {
+            nodes_[u].succs.emplace_back(v);
+            nodes_[v].preds.emplace_back(u);
+            insert_reachable(u, v);
+        }
+    }
+}
+
+void DomTree::remove_edge(const Expr* from, const Expr* to) {
+    auto x = index(from);
+    auto y = index(to);
+    if (x == Nil || y == Nil) return;
+    if (std::ranges::find(nodes_[x].succs, y) == nodes_[x].succs.end()) return;
+
+    if (lca(x, y) == y) { // y dominates x: no path from entry needs this back edge
+        erase_edge(x, y);
+    } else if (nodes_[y].idom == x && !has_proper_support(y, x)) {
+        remove_unreachable(x, y);
+    } else {
+        erase_edge(x, y);
+        remove_reachable(y);
+    }
+}
+
+/// After inserting `(x, y)`, a BB `w` is *affected* - its new idom is `nca = lca(x, y)` - iff
+/// `depth(w) > depth(nca) + 1` and there is a path from `y` to `w` that never goes above `depth(w)`.
+/// Starting from `y`, we visit candidates deepest first; the search from a candidate at depth `d` only continues
+/// through BBs below `d` and defers the others as new candidates.
+void DomTree::insert_reachable(Index x, Index y) {
+    auto nca   = lca(x, y);
+    auto level = depth(nca) + 1; // BBs at this depth or above are never affected
+    if (depth(y) <= level) return;
+
+    std::priority_queue<std::pair<size_t, Index>> candidates;
+    std::vector<Index> visited{y}, stack, affected;
+    num_[y] = 0;
+    candidates.emplace(depth(y), y);
+
+    while (!candidates.empty()) {
+        auto [d, z] = candidates.top();
+        candidates.pop();
+        affected.emplace_back(z);
+
+        for (stack.emplace_back(z); !stack.empty();) {
+            auto v = stack.back();
+            stack.pop_back();
+            for (auto s : nodes_[v].succs) {
+                if (num_[s] != Nil) continue;
+                auto ds = depth(s);
+                if (ds <= level) continue;
+
+                num_[s] = 0;
+                visited.emplace_back(s);
+                if (ds > d)
+                    stack.emplace_back(s);
+                else
+                    candidates.emplace(ds, s);
+            }
+        }
+    }
+    for (auto v : visited) num_[v] = Nil;
+
+    std::vector<std::pair<Index, Index>> idoms;
+    for (auto w : affected) idoms.emplace_back(w, nca);
+    reattach(idoms);
+}
+
+/// Does @p y have a predecessor besides @p x that it does not dominate, i.e. does @p y stay reachable without `(x, y)`?
+bool DomTree::has_proper_support(Index y, Index x) const {
+    for (auto p : nodes_[y].preds)
+        if (p != x && lca(p, y) != y) return true;
+    return false;
+}
+
+void DomTree::erase_edge(Index x, Index y) {
+    std::erase(nodes_[x].succs, y);
+    std::erase(nodes_[y].preds, x);
+}
+
+/// An edge into @p y is gone, but @p y is still reachable.
+/// If @p y keeps its idom, so does every other BB: a path that avoided some BB and used the removed edge
+/// can take a detour to @p y that still avoids it.
+void DomTree::remove_reachable(Index y) {
+    if (!keeps_idom(y)) rebuild(y);
+}
+
+namespace {
+
+enum class Dir { Fwd, Bwd };
+enum class Visit { Seen, New, Meet };
+
+/// Bidirectional BFS from @p src and backwards from @p dst that grows the smaller frontier by one level at a time.
+/// `next(s, dir, f)` invokes `f` on the successors or predecessors of state `s`, depending on `dir`.
+/// `visit(t, dir, s)` marks state `t` as reached from `s` in direction `dir` and tells whether the other side has been there.
+/// @returns whether the two searches met.
+template<class State, class Next, class Visitor>
+bool meet(State src, State dst, Next next, Visitor visit) {
+    visit(src, Dir::Fwd, src);
+    visit(dst, Dir::Bwd, dst);
+    std::vector<State> frontiers[2] = {{src}, {dst}}, level;
+    while (!frontiers[0].empty() && !frontiers[1].empty()) {
+        auto k   = frontiers[0].size() <= frontiers[1].size() ? 0 : 1;
+        auto dir = Dir(k);
+        bool met = false;
+        level.clear();
+        for (auto s : frontiers[k]) {
+            next(s, dir, [&](State t) {
+                if (met) return;
+                switch (visit(t, dir, s)) {
+                    case Visit::Seen: break;
+                    case Visit::New: level.emplace_back(t); break;
+                    case Visit::Meet: met = true; break;
+                }
+            });
+            if (met) return true;
+        }
+        std::swap(frontiers[k], level);
+    }
+    return false;
+}
+
+} // namespace
+
+/// Does @p y keep its idom `d`?
+/// This holds iff `d` still jumps to @p y or two paths from `d` to @p y share no BB in between (Menger's theorem).
+/// We look for these as augmenting paths of a unit flow, each via a bidirectional search:
+/// forwards from `d` through its dominator subtree and backwards from @p y, which never leaves that subtree either.
+/// Both usually meet after a few levels; if @p y loses its idom, the side behind the new one runs dry early.
+bool DomTree::keeps_idom(Index y) {
+    auto d = nodes_[y].idom;
+    if (std::ranges::find(nodes_[y].preds, d) != nodes_[y].preds.end()) return true;
+
+    auto level = depth(d);
+    std::vector<Index> visited, path;
+    auto mark = [&](Index v, Index bit) {
+        if (num_[v] == Nil) {
+            num_[v] = 0;
+            visited.emplace_back(v);
+        }
+        num_[v] |= bit;
+    };
+
+    // first path: d, ..., y - num_ marks the sides that have seen a BB, aux_ holds the BB it was seen from
+    enum : Index { Fwd = 1, Bwd = 2 };
+    Index fwd_end = Nil, bwd_end = Nil;
+    [[maybe_unused]] auto found = meet(
+        d, y,
+        [&](Index v, Dir dir, auto f) {
+            if (dir == Dir::Fwd) {
+                for (auto s : nodes_[v].succs)
+                    if (depth(s) > level) f(s);
+            } else {
+                for (auto p : nodes_[v].preds) f(p);
+            }
+        },
+        [&](Index v, Dir dir, Index from) {
+            auto [bit, other] = dir == Dir::Fwd ? std::pair(Fwd, Bwd) : std::pair(Bwd, Fwd);
+            auto seen         = num_[v] == Nil ? 0 : num_[v];
+            if (seen & bit) return Visit::Seen;
+            if (seen & other) {
+                std::tie(fwd_end, bwd_end) = dir == Dir::Fwd ? std::pair(from, v) : std::pair(v, from);
+                return Visit::Meet;
+            }
+            mark(v, bit);
+            aux_[v] = from;
+            return Visit::New;
+        });
+    assert(found && "y is still reachable");
+    for (auto v = fwd_end; v != d; v = aux_[v]) path.emplace_back(v);
+    path.emplace_back(d);
+    std::ranges::reverse(path);
+    for (auto v = bwd_end; v != y; v = aux_[v]) path.emplace_back(v);
+    path.emplace_back(y);
+    for (auto v : visited) num_[v] = aux_[v] = Nil;
+    visited.clear();
+    for (Index i = 0, e = Index(path.size()); i != e; ++i) aux_[path[i]] = i;
+
+    // second path in the residual graph, where each BB v splits into v_in -> v_out with capacity 1:
+    // only the edges of the first path - and v_in -> v_out for each BB v on it - are reversed
+    enum : Index { Fwd_In = 1, Fwd_Out = 2, Bwd_In = 4, Bwd_Out = 8 };
+    using State = std::pair<Index, bool>; // BB, out
+    auto res = meet(
+        State(d, true), State(y, false),
+        [&](State state, Dir dir, auto f) {
+            auto [v, out] = state;
+            auto pos      = aux_[v];
+            if (dir == Dir::Fwd && out) {
+                for (auto s : nodes_[v].succs)
+                    if ((pos == Nil || s != path[pos + 1]) && depth(s) > level) f(State(s, false));
+                if (pos != Nil && v != d) f(State(v, false));
+            } else if (dir == Dir::Fwd) {
+                if (pos == Nil) f(State(v, true));
+                else if (pos != 1) f(State(path[pos - 1], true));
+            } else if (out) {
+                f(State(pos == Nil ? v : path[pos + 1], false));
+            } else {
+                for (auto p : nodes_[v].preds)
+                    if (p != y && (pos == Nil || p != path[pos - 1])) f(State(p, true));
+                if (pos != Nil && v != y) f(State(v, true));
+            }
+        },
+        [&](State state, Dir dir, State) {
+            auto [v, out] = state;
+            auto fwd      = out ? Fwd_Out : Fwd_In;
+            auto bwd      = out ? Bwd_Out : Bwd_In;
+            auto [bit, other] = dir == Dir::Fwd ? std::pair(fwd, bwd) : std::pair(bwd, fwd);
+            auto seen         = num_[v] == Nil ? 0 : num_[v];
+            if (seen & bit) return Visit::Seen;
+            if (seen & other) return Visit::Meet;
+            mark(v, bit);
+            return Visit::New;
+        });
+
+    for (auto v : visited) num_[v] = Nil;
+    for (auto v : path) aux_[v] = Nil;
+    return res;
+}
+
+/// Removing `(x, y)` cuts @p y and its dominator subtree off the entry: drop them.
+/// Before, we remove their edges to the other BBs one at a time: `(x, y)` keeps them reachable meanwhile,
+/// so each of these is an ordinary removal - and afterwards, no other BB depends on them.
+void DomTree::remove_unreachable(Index x, Index y) {
+    std::vector<std::pair<Index, Index>> exits;
+    search(y, depth(y), &exits);
+    for (auto [u, v] : exits) {
+        erase_edge(u, v);
+        if (lca(u, v) != v) remove_reachable(v);
+    }
+    erase_edge(x, y);
+
+    auto region = search(y, depth(y));
+    for (auto v : region.order | std::views::reverse) nodes_[v].cut();
+    for (auto v : region.order) {
+        index_[nodes_[v].bb->gid] = Nil;
+        nodes_[v]                 = Node(nullptr);
+        free_.emplace_back(v);
+    }
+}
+
+/*
+ * Semi-NCA
+ */
+
+/// Allocates a Node for @p bb.
+DomTree::Index DomTree::add(const Expr* bb) {
+    Index i;
+    if (free_.empty()) {
+        i = Index(nodes_.size());
+        nodes_.emplace_back(bb);
+        num_.emplace_back(Nil);
+        aux_.emplace_back(Nil);
+    } else {
+        i = free_.back();
+        free_.pop_back();
+        nodes_[i] = Node(bb);
+    }
+    if (index_.size() <= bb->gid) index_.resize(bb->world().gid, Nil);
+    index_[bb->gid] = i;
+    return i;
+}
+
+/// Creates Node%s for @p root and all BB%s without a Node that are reachable from there, along with their CFG edges.
+/// Edges into BB%s that already had a Node are not added but collected in @p external.
+DomTree::Region DomTree::discover(const Expr* root, std::vector<std::pair<Index, Index>>& external) {
+    if (size_t num_gids = root->world().gid; mark_.size() < num_gids) mark_.resize(num_gids, Nil);
+
+    Region region;
+    std::vector<const Expr*> succs, stack;
+    std::vector<size_t> succs_begin, succs_end; // position -> range of its successors in succs
+    struct Frame {
+        Index pos;
+        size_t i;
+    };
+    std::vector<Frame> frames;
+
+    auto visit = [&](const Expr* bb, Index parent) {
+        auto v   = add(bb);
+        auto pos = Index(region.order.size());
+        num_[v]  = pos;
+        region.order.emplace_back(v);
+        region.parent.emplace_back(parent);
+
+        if (++walk_ == Nil) { // wrap around
+            std::ranges::fill(mark_, Nil);
+            walk_ = 0;
+        }
+        succs_begin.emplace_back(succs.size());
+        for_each_succ(
+            bb, stack, [&](const Expr* e) { return std::exchange(mark_[e->gid], walk_) != walk_; },
+            [&](const Expr* s) { succs.emplace_back(s); });
+        succs_end.emplace_back(succs.size());
+        frames.emplace_back(pos, succs_begin[pos]);
+    };
+
+    visit(root, Nil);
+    while (!frames.empty()) {
+        auto [pos, i] = frames.back();
+        if (i == succs_end[pos]) {
+            frames.pop_back();
+            continue;
+        }
+
+        ++frames.back().i;
+        auto u = region.order[pos];
+        auto v = index(succs[i]);
+        if (v == Nil) {
+            visit(succs[i], pos);
+            v = region.order.back();
+        }
+
+        if (num_[v] == Nil) {
+            external.emplace_back(u, v);
+        } else {
+            nodes_[u].succs.emplace_back(v);
+            nodes_[v].preds.emplace_back(u);
+        }
+    }
+
+    for (auto v : region.order) num_[v] = Nil;
+    return region;
+}
+
+/// DFS from @p root through the BBs that are deeper than @p level in the dominator tree.
+/// If given, @p exits collects the edges to successors that are not.
+DomTree::Region DomTree::search(Index root, size_t level, std::vector<std::pair<Index, Index>>* exits) {
+    Region region{{root}, {Nil}};
+    std::vector<std::pair<Index, size_t>> frames{{0, 0}}; // position, next successor
+    num_[root] = 0;
+
+    while (!frames.empty()) {
+        auto [pos, i] = frames.back();
+        const auto& succs = nodes_[region.order[pos]].succs;
+        if (i == succs.size()) {
+            frames.pop_back();
+            continue;
+        }
+
+        ++frames.back().second;
+        auto v = succs[i];
+        if (num_[v] != Nil) continue;
+        if (depth(v) > level) {
+            num_[v] = Index(region.order.size());
+            region.order.emplace_back(v);
+            region.parent.emplace_back(pos);
+            frames.emplace_back(num_[v], 0);
+        } else if (exits) {
+            exits->emplace_back(region.order[pos], v);
+        }
+    }
+
+    for (auto v : region.order) num_[v] = Nil;
+    return region;
+}
+
+/// Semi-NCA on @p region; only predecessors within @p region count - and for Region::fixed BBs only their idom.
+/// @returns the immediate dominators as positions within @p region - except for the root.
+std::vector<DomTree::Index> DomTree::semi_nca(const Region& region) {
+    auto n = Index(region.order.size());
+    for (Index i = 0; i != n; ++i) num_[region.order[i]] = i;
+
+    // semidominators via link-eval with iterative path compression ...
+    std::vector<Index> semi(n), label(n), ancestor(n, Nil), idom(n, Nil), path;
+    std::iota(semi.begin(), semi.end(), 0);
+    std::iota(label.begin(), label.end(), 0);
+
+    auto eval = [&](Index v) {
+        if (ancestor[v] == Nil) return v;
+        path.clear();
+        for (auto x = v; ancestor[ancestor[x]] != Nil; x = ancestor[x]) path.emplace_back(x);
+        for (auto i = path.size(); i-- != 0;) {
+            auto x = path[i];
+            auto a = ancestor[x];
+            if (semi[label[a]] < semi[label[x]]) label[x] = label[a];
+            ancestor[x] = ancestor[a];
+        }
+        return label[v];
+    };
+
+    for (Index w = n; w-- > 1;) {
+        const auto& node = nodes_[region.order[w]];
+        if (!region.fixed.empty() && region.fixed[w]) {
+            semi[w] = std::min(semi[w], semi[eval(num_[node.idom])]);
+        } else {
+            for (auto p : node.preds)
+                if (auto v = num_[p]; v != Nil) semi[w] = std::min(semi[w], semi[eval(v)]);
+        }
+        ancestor[w] = region.parent[w];
+    }
+
+    // ... and the immediate dominator is the nearest common ancestor of semi[w] and parent[w] in the dominator tree
+    for (Index w = 1; w < n; ++w) {
+        auto d = region.parent[w];
+        while (d > semi[w]) d = idom[d];
+        idom[w] = d;
+    }
+
+    for (auto v : region.order) num_[v] = Nil;
+    return idom;
+}
+
+/// Links the fresh Node%s of @p region below their immediate dominators and its root below @p idom.
+void DomTree::attach(const Region& region, Index idom) {
+    auto idoms = semi_nca(region);
+    for (size_t i = 0, e = region.order.size(); i != e; ++i) {
+        auto w = region.order[i];
+        auto d = i == 0 ? idom : region.order[idoms[i]];
+        if (d == Nil) continue;
+        nodes_[w].idom = d;
+        nodes_[d].link(&nodes_[w]);
+    }
+}
+
+/// @p y has lost its idom `d`: find all BB%s that do and rerun Semi-NCA on them.
+/// Seen backwards, this is the insertion of the removed edge, which moves BB%s right below `d`. So only children of `d`
+/// may move, and each other one that does has a predecessor in the dominator subtree of one that does.
+/// All other BB%s keep their idoms, so we may replace their incoming edges by the one from there: Semi-NCA then only
+/// needs `d`, the moving children, and the dominator-tree paths from these down to their predecessors.
+void DomTree::rebuild(Index y) {
+    auto d = nodes_[y].idom;
+    std::vector<Index> moved{y};
+    ExprSet tested;
+    tested.emplace(nodes_[y].bb);
+    for (size_t i = 0; i != moved.size(); ++i) {
+        auto subtree = search(moved[i], depth(moved[i]));
+        for (auto t : subtree.order)
+            for (auto w : nodes_[t].succs)
+                if (nodes_[w].idom == d && tested.emplace(nodes_[w].bb).second && !keeps_idom(w)) moved.emplace_back(w);
+    }
+
+    enum : Index { Moved, Fixed }; // aux_
+    for (auto w : moved) aux_[w] = Moved;
+    std::vector<std::pair<Index, Index>> tree; // idom, fixed BB
+    for (auto w : moved)
+        for (auto p : nodes_[w].preds)
+            for (auto u = p; u != d && aux_[u] == Nil; u = nodes_[u].idom) {
+                aux_[u] = Fixed;
+                tree.emplace_back(nodes_[u].idom, u);
+            }
+    std::ranges::sort(tree);
+
+    // DFS from d: a fixed BB is only entered from its idom, a moving one via its CFG edges
+    Region region{{d}, {Nil}, {false}};
+    std::vector<std::pair<Index, size_t>> frames{{0, 0}}; // position, next successor
+    num_[d] = 0;
+    while (!frames.empty()) {
+        auto [pos, i]     = frames.back();
+        auto u            = region.order[pos];
+        const auto& succs = nodes_[u].succs;
+        auto [begin, end] = std::ranges::equal_range(tree, u, {}, &std::pair<Index, Index>::first);
+        if (i == succs.size() + size_t(end - begin)) {
+            frames.pop_back();
+            continue;
+        }
+
+        ++frames.back().second;
+        auto v = i < succs.size() ? succs[i] : begin[i - succs.size()].second;
+        if (num_[v] != Nil || (i < succs.size() && aux_[v] != Moved)) continue;
+        num_[v] = Index(region.order.size());
+        region.order.emplace_back(v);
+        region.parent.emplace_back(pos);
+        region.fixed.emplace_back(aux_[v] == Fixed);
+        frames.emplace_back(num_[v], 0);
+    }
+    assert(region.order.size() == 1 + moved.size() + tree.size());
+
+    auto idoms = semi_nca(region);
+    std::vector<std::pair<Index, Index>> changed;
+    for (size_t i = 1, e = region.order.size(); i != e; ++i) {
+        auto w = region.order[i], idom = region.order[idoms[i]];
+        assert(region.fixed[i] == (nodes_[w].idom == idom));
+        if (nodes_[w].idom != idom) changed.emplace_back(w, idom);
+    }
+
+    for (auto w : moved) aux_[w] = Nil;
+    for (auto [_, u] : tree) aux_[u] = Nil;
+    reattach(changed);
+}
+
+/// Moves each `w` of @p idoms below its new immediate dominator `d`.
+/// We first cut all of them, so no link ever sees `d` below `w`.
+void DomTree::reattach(std::span<const std::pair<Index, Index>> idoms) {
+    for (auto [w, _] : idoms) nodes_[w].cut();
+    for (auto [w, d] : idoms) {
+        nodes_[w].idom = d;
+        nodes_[d].link(&nodes_[w]);
+    }
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+
+#include <deque>
+#include <span>
+#include <vector>
+
+#include "expr.h"
+
+/// [Dominator tree](https://en.wikipedia.org/wiki/Dominator_(graph_theory)) of the CFG that is reachable from an *entry* Tag::BB.
+/// The CFG successors of a BB are all BB%s that its body reaches without passing through another BB; see DomTree::succs.
+///
+/// Construction uses *Semi-NCA* (Georgiadis, 2005) with an iteratively path-compressing link-eval forest,
+/// which runs in O(m log n) worst case and in practice in near-linear time.
+/// The resulting tree lives in a LinkCutTree, so DomTree::lca - the nearest common dominator - costs O(log n) amortized.
+///
+/// After mutating Expr::ops, DomTree::update keeps the tree in sync without a rebuild
+/// (following the depth-based search of Georgiadis et al., 2016):
+/// * An inserted edge `(x, y)` only moves the *affected* BB%s below `lca(x, y)` - these are found by a search that
+///   never descends to or above that depth.
+/// * A removed edge `(x, y)` first checks whether `y` keeps its idom `d` - via two bidirectional searches between `d`
+///   and `y` that usually meet after a few levels. If so, no BB moves. Otherwise, only children of `d` may move:
+///   the same check runs on those that the moving ones jump to, and Semi-NCA reruns on the moving children only,
+///   with all other BB%s collapsed onto their dominator-tree paths.
+///   If `y` becomes unreachable, its edges to other BB%s are removed one by one, and then its dominator subtree is dropped.
+///
+/// In *verified* mode, each DomTree::update asserts that the result matches a rebuild from scratch.
+class DomTree {
+public:
+    using Index                = uint32_t;
+    static constexpr Index Nil = Index(-1);
+
+    DomTree(const Expr* entry, bool verified = false);
+    DomTree(const DomTree&)            = delete;
+    DomTree& operator=(const DomTree&) = delete;
+
+    /// @name Getters
+    ///@{
+    const Expr* entry() const { return nodes_.front().bb; }
+    /// Number of reachable BB%s.
+    size_t size() const { return nodes_.size() - free_.size(); }
+    bool is_reachable(const Expr* bb) const { return index(bb) != Nil; }
+    /// Immediate dominator of @p bb or `nullptr` for DomTree::entry; @p bb must be reachable.
+    const Expr* idom(const Expr* bb) const;
+    /// Number of proper dominators of @p bb; @p bb must be reachable.
+    size_t depth(const Expr* bb) const { return depth(index(bb)); }
+    ///@}
+
+    /// @name Queries
+    /// @p a and @p b must be reachable.
+    ///@{
+    /// Nearest common dominator of @p a and @p b.
+    const Expr* lca(const Expr* a, const Expr* b) const { return nodes_[lca(index(a), index(b))].bb; }
+    /// Does @p a dominate @p b? Each BB dominates itself.
+    bool dominates(const Expr* a, const Expr* b) const { return lca(a, b) == a; }
+    ///@}
+
+    /// @name Incremental Updates
+    ///@{
+    /// Call this after you have changed the body of @p bb - or anything its body reaches up to the next BB.
+    /// Recomputes DomTree::succs of @p bb and inserts/removes the CFG edges that differ.
+    /// Does nothing if @p bb is unreachable: its successors are computed once it becomes reachable.
+    void update(const Expr* bb);
+    /// Low-level interface to DomTree::update: the CFG edge `(from, to)` has been added or removed, respectively.
+    /// Nothing is verified, as Expr::ops may already contain further changes.
+    void insert_edge(const Expr* from, const Expr* to);
+    void remove_edge(const Expr* from, const Expr* to);
+    ///@}
+
+    /// Does this DomTree match one that is built from scratch?
+    bool verify() const;
+
+    /// CFG successors of @p bb in order of discovery, without duplicates.
+    static std::vector<const Expr*> succs(const Expr* bb);
+
+private:
+    struct Node : public LinkCutTree<const Node, agg::Count> {
+        Node(const Expr* bb)
+            : bb(bb) {}
+
+        const Expr* bb;
+        Index idom = Nil;
+        std::vector<Index> succs, preds; ///< CFG edges between reachable BB%s.
+    };
+
+    /// Reachable BB%s in DFS preorder from `order[0]`; `parent` holds the DFS parents as positions within `order`.
+    /// If not empty, `fixed` marks the positions whose idom is already known: Semi-NCA only follows the edge from there.
+    struct Region {
+        std::vector<Index> order, parent;
+        std::vector<bool> fixed = {};
+    };
+
+    Index index(const Expr* bb) const { return bb->gid < index_.size() ? index_[bb->gid] : Nil; }
+    size_t depth(Index i) const {
+        assert(i != Nil && "BB is not reachable from entry");
+        return nodes_[i].path_aggregate() - 1;
+    }
+    Index lca(Index a, Index b) const;
+
+    Index add(const Expr* bb);
+    Region discover(const Expr* root, std::vector<std::pair<Index, Index>>& external);
+    Region search(Index root, size_t level, std::vector<std::pair<Index, Index>>* exits = nullptr);
+    std::vector<Index> semi_nca(const Region& region);
+    void attach(const Region& region, Index idom);
+    void reattach(std::span<const std::pair<Index, Index>> idoms);
+    void rebuild(Index y);
+
+    void insert_reachable(Index x, Index y);
+    void erase_edge(Index x, Index y);
+    void remove_reachable(Index y);
+    void remove_unreachable(Index x, Index y);
+    bool keeps_idom(Index y);
+    bool has_proper_support(Index y, Index x) const;
+
+    std::deque<Node> nodes_;   ///< nodes_[0] is the entry; Node%s of BB%s that became unreachable are recycled via free_.
+    std::vector<Index> free_;  ///< Unused slots in nodes_.
+    std::vector<Index> index_; ///< Expr::gid -> index into nodes_ or DomTree::Nil.
+    std::vector<Index> mark_;  ///< Expr::gid -> last walk through this Expr in DomTree::discover.
+    std::vector<Index> num_;   ///< Scratch: index into nodes_ -> position within the current Region or DomTree::Nil.
+    std::vector<Index> aux_;   ///< Scratch like num_ for a second value per Node; DomTree::Nil when unused.
+    Index walk_ = 0;
+    bool verified_;
+};
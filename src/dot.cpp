@@ -0,0 +1,118 @@
+#include "dot.h"
+
+#include <charconv>
+
+#include "world.h"
+
+static constexpr size_t Flush_Size = 64 * 1024;
+
+std::ostream& DotWriter::write(std::ostream& os, const Expr* root) {
+    size_t num_words = (root->world().gid + 63) / 64;
+    if (visited_.size() < num_words) visited_.resize(num_words, 0);
+
+    buf_.clear();
+    buf_ += "digraph A {\n";
+
+    if (uint8_t(view_) & uint8_t(View::Rep)) {
+        bfs(os, root, false, [&](const Expr* expr, size_t depth) {
+            if (depth >= limits_.max_depth) {
+                truncated_ = std::ranges::any_of(expr->ops(), [](auto op) { return op != nullptr; });
+                return;
+            }
+            for (auto op : expr->ops()) {
+                if (!op) continue;
+                if (visit(op, depth + 1))
+                    edge(expr, op, false, "[color=black]");
+                else
+                    truncated_ = true;
+            }
+        });
+    }
+
+    if (uint8_t(view_) & uint8_t(View::Aux)) {
+        bfs(os, root, true, [&](const Expr* expr, size_t depth) {
+            bool expand = depth < limits_.max_depth;
+            auto follow = [&](const Expr* e) {
+                if (!e) return false;
+                if (expand && visit(e, depth + 1)) return true;
+                truncated_ = true;
+                return false;
+            };
+
+            for (auto op : expr->ops()) follow(op);
+            bool l = follow(expr->left());
+            bool r = follow(expr->right());
+
+            if (auto p = expr->splay_parent()) edge(expr, p, true, "[style=dashed]");
+            if (auto p = expr->path_parent()) edge(expr, p, true, "[style=dashed,color=gray]");
+            if (l) edge(expr, expr->left(), true, "[color=green]");
+            if (r) edge(expr, expr->right(), true, "[color=red]");
+        });
+    }
+
+    buf_ += "}\n";
+    flush(os, true);
+    return os.flush();
+}
+
+template<class F>
+void DotWriter::bfs(std::ostream& os, const Expr* root, bool aux, F edges) {
+    queue_.clear();
+    visit(root, 0);
+    for (size_t i = 0; i != queue_.size(); ++i) {
+        auto [expr, depth] = queue_[i];
+        truncated_         = false;
+        edges(expr, depth);
+        if (truncated_) {
+            buf_ += '\t';
+            node(expr, aux);
+            buf_ += "[style=dotted];\n";
+        }
+        flush(os);
+    }
+
+    for (auto [expr, _] : queue_) visited_[expr->gid / 64] &= ~(UINT64_C(1) << (expr->gid % 64));
+}
+
+bool DotWriter::visit(const Expr* expr, size_t depth) {
+    auto& word = visited_[expr->gid / 64];
+    auto bit   = UINT64_C(1) << (expr->gid % 64);
+    if (word & bit) return true;
+    if (queue_.size() >= limits_.max_nodes) return false;
+    word |= bit;
+    queue_.emplace_back(expr, depth);
+    return true;
+}
+
+/// Same as Expr::str_.
+void DotWriter::node(const Expr* expr, bool aux) {
+    char num[24];
+    auto append = [&](uint64_t u) { buf_.append(num, std::to_chars(num, num + sizeof(num), u).ptr); };
+
+    buf_ += aux ? "\"_ " : "\" ";
+    append(expr->gid);
+    buf_ += ": ";
+    if (expr->tag == Tag::Lit)
+        append(expr->stuff);
+    else if (expr->tag == Tag::Id)
+        buf_ += char(expr->stuff);
+    else
+        buf_ += tag2str(expr->tag);
+    buf_ += '"';
+}
+
+void DotWriter::edge(const Expr* from, const Expr* to, bool aux, const char* attrs) {
+    buf_ += '\t';
+    node(from, aux);
+    buf_ += " -> ";
+    node(to, aux);
+    buf_ += attrs;
+    buf_ += ";\n";
+}
+
+void DotWriter::flush(std::ostream& os, bool force) {
+    if (force || buf_.size() >= Flush_Size) {
+        os.write(buf_.data(), std::streamsize(buf_.size()));
+        buf_.clear();
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+
+#include <limits>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "expr.h"
+
+/// Writes Expr%s in [GraphViz' Dot](https://graphviz.org/doc/info/lang.html) format; see also Expr::dot.
+/// * The *rep* view shows the Expr::ops edges; the *aux* view the LinkCutTree pointers between `_`-prefixed nodes:
+///     splay parents dashed, path parents dashed gray, left children green, and right children red.
+/// * Both views visit the Expr%s in BFS order from the root and stop expanding an Expr once it is Limits::max_depth
+///     edges away from the root or once Limits::max_nodes Expr%s have been visited;
+///     Expr%s whose neighbors have been cut off this way are drawn dotted.
+/// * Output is first rendered into an internal buffer that is flushed in large chunks;
+///     visited Expr%s are tracked in a bitmap indexed by Expr::gid.
+///     Both stay allocated, so reusing a DotWriter for several dumps doesn't allocate anymore.
+class DotWriter {
+public:
+    enum class View : uint8_t {
+        Rep  = 1,
+        Aux  = 2,
+        Both = Rep | Aux,
+    };
+
+    struct Limits {
+        size_t max_depth = std::numeric_limits<size_t>::max();
+        size_t max_nodes = std::numeric_limits<size_t>::max();
+    };
+
+    DotWriter(View view = View::Both)
+        : view_(view) {}
+    DotWriter(View view, Limits limits)
+        : view_(view)
+        , limits_(limits) {}
+
+    std::ostream& write(std::ostream&, const Expr* root);
+
+private:
+    /// BFS from @p root along Expr::ops and - if @p aux - LinkCutTree::left and LinkCutTree::right.
+    /// Calls `edges(expr, depth)` for each visited Expr in BFS order.
+    template<class F>
+    void bfs(std::ostream&, const Expr* root, bool aux, F edges);
+    /// Visits @p expr unless the Limits are exhausted; @returns whether @p expr has been visited.
+    bool visit(const Expr* expr, size_t depth);
+
+    void node(const Expr*, bool aux);
+    void edge(const Expr* from, const Expr* to, bool aux, const char* attrs);
+    void flush(std::ostream& os, bool force = false);
+
+    View view_;
+    Limits limits_ = {};
+    std::string buf_;
+    std::vector<uint64_t> visited_;                   ///< Bitmap indexed by Expr::gid.
+    std::vector<std::pair<const Expr*, size_t>> queue_; ///< Expr + depth.
+    bool truncated_;                                  ///< Has the current Expr lost a neighbor due to the Limits?
+};
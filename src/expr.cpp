@@ -1,11 +1,13 @@
 #include "expr.h"
 
 #include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <fstream>
 #include <format>
-#include <queue>
+#include <ranges>
 
+#include "dot.h"
 #include "world.h"
 
 using namespace std::string_literals;
@@ -28,41 +30,68 @@ std::string tag2str(Tag tag) {
     }
 }
 
-Expr::Expr(World& world, Tag tag, std::span<const Expr*> ops, uint64_t stuff)
-    : world(world)
-    , gid(world.next_gid())
-    , mut(false)
+Expr::Expr(uint32_t gid, Tag tag, std::span<const Expr* const> ops, uint64_t stuff, size_t hash)
+    : gid(gid)
     , tag(tag)
-    , ops(ops.begin(), ops.end())
+    , mut(false)
+    , num_ops(uint8_t(ops.size()))
     , stuff(stuff)
-    , hash(size_t(tag)) {
-    agg = gid;
-    hash ^= stuff << 1;
-    for (auto op : ops) {
-        hash ^= op->gid << 1;
-        this->link(op);
-    }
+    , hash(hash) {
+    std::ranges::copy(ops, this->ops().begin());
+    for (size_t i = 0; i != num_ops; ++i) new (&use_slots()[i]) Use(i);
 }
 
-Expr::Expr(World& world)
-    : world(world)
-    , gid(world.next_gid())
-    , mut(true)
+Expr::Expr(uint32_t gid, size_t hash)
+    : gid(gid)
     , tag(Tag::BB)
-    , ops(1, nullptr)
+    , mut(true)
+    , num_ops(1)
     , stuff(0)
-    , hash(gid) {
-    agg = gid;
-    std::ranges::fill(ops, nullptr);
+    , hash(hash) {
+    std::ranges::fill(ops(), nullptr);
+    for (size_t i = 0; i != num_ops; ++i) new (&use_slots()[i]) Use(i);
+}
+
+World& Expr::world() const { return *static_cast<World*>(Arena::owner(this)); }
+
+void Expr::journal_op(size_t i) {
+    if (auto& w = world(); &w == speculating) w.journal_op(this, i);
+}
+
+void Expr::journal_aux() const {
+    if (auto& w = world(); &w == speculating) w.journal_aux(this);
+}
+
+size_t Expr::hash_of(Tag tag, std::span<const Expr* const> ops, uint64_t stuff) {
+    auto hash = hash_combine(uint64_t(tag), stuff);
+    for (auto op : ops) hash = hash_combine(hash, op->hash);
+    return hash_mix(hash);
+}
+
+bool Expr::equal(Tag tag, std::span<const Expr* const> ops, uint64_t stuff, const Expr* e) {
+    if (e->mut) return false;
+
+    bool res = e->tag == tag && e->stuff == stuff && e->num_ops == ops.size();
+    size_t n = ops.size();
+    for (size_t i = 0; i != n && res; ++i) res &= e->op(i) == ops[i];
+    return res;
 }
 
 bool Expr::equal(const Expr* e1, const Expr* e2) {
     if (e1->mut || e2->mut) return e1 == e2;
+    return equal(e1->tag, e1->ops(), e1->stuff, e2);
+}
 
-    bool res = e1->tag == e2->tag && e1->stuff == e2->stuff && e1->ops.size() == e2->ops.size();
-    size_t n = e1->ops.size();
-    for (size_t i = 0; i != n && res; ++i) res &= e1->ops[i]->gid == e2->ops[i]->gid;
-    return res;
+bool Expr::less(const Expr* a, const Expr* b) {
+    if (a == b) return false;
+    if (a->hash != b->hash) return a->hash < b->hash;
+    if (a->mut || b->mut) return a->mut != b->mut ? b->mut : a->gid < b->gid;
+    if (a->tag != b->tag) return a->tag < b->tag;
+    if (a->stuff != b->stuff) return a->stuff < b->stuff;
+    if (a->num_ops != b->num_ops) return a->num_ops < b->num_ops;
+    for (size_t i = 0, n = a->num_ops; i != n; ++i)
+        if (a->op(i) != b->op(i)) return less(a->op(i), b->op(i));
+    return false;
 }
 
 std::string Expr::name() const {
@@ -71,71 +100,90 @@ std::string Expr::name() const {
     return tag2str(tag);
 }
 
-//std::string Expr::str_(bool prefix) const { return std::format("\"{} {}: {} ({})\"", prefix ? "_" : "", gid, name(), agg); }
+//std::string Expr::str_(bool prefix) const { return std::format("\"{} {}: {} ({})\"", prefix ? "_" : "", gid, name(), value()); }
 std::string Expr::str_(bool prefix) const { return std::format("\"{} {}: {}\"", prefix ? "_" : "", gid, name()); }
 
 std::ostream& Expr::dump(std::ostream& o) const {
-    if (tag == Tag::Lit) return o << stuff;
-    if (tag == Tag::Id) return o << (char)stuff;
-    o << "(" << tag2str(tag);
-    for (auto op : ops) op->dump(o << " ");
-    return o << ")";
-}
-
-std::ostream& Expr::dump() const { return dump(std::cout) << std::endl; }
-
-void Expr::dot() const {
-    static int i = 0;
-    dot("out" + std::to_string(i++) + ".dot");
-}
+    auto is_leaf = [](const Expr* e) { return e->tag == Tag::Lit || e->tag == Tag::Id; };
+
+    // count the uses of all inner Expr%s - `this` counts as used once, so a cycle back to it makes it shared
+    ExprMap<uint32_t> uses;
+    std::vector<const Expr*> todo;
+    uses[this] = 1;
+    todo.emplace_back(this);
+    while (!todo.empty()) {
+        auto e = todo.back();
+        todo.pop_back();
+        for (auto op : e->ops())
+            if (op && !is_leaf(op) && uses[op]++ == 0) todo.emplace_back(op);
+    }
+    auto is_bound = [&](const Expr* e) { return !is_leaf(e) && (e->mut || uses[e] >= 2); };
+
+    // prints e with all operands that are neither leaves nor bound inline - each unbound Expr has a single use
+    std::vector<std::pair<const Expr*, bool>> items; // Expr + leading space?; nullptr closes a parenthesis
+    auto body = [&](const Expr* e) {
+        items.emplace_back(e, false);
+        while (!items.empty()) {
+            auto [x, space] = items.back();
+            items.pop_back();
+            if (!x) {
+                o << ')';
+                continue;
+            }
 
-void Expr::dot(std::string name) const {
-    std::ofstream ofs(name);
-    dot(ofs);
-}
+            if (space) o << ' ';
+            if (x->tag == Tag::Lit) {
+                o << x->stuff;
+            } else if (x->tag == Tag::Id) {
+                o << (char)x->stuff;
+            } else if (space && is_bound(x)) { // only the outermost Expr has no leading space
+                o << '_' << x->gid;
+            } else {
+                o << '(' << tag2str(x->tag);
+                items.emplace_back(nullptr, false);
+                for (auto op : x->ops() | std::views::reverse)
+                    if (op) items.emplace_back(op, true);
+            }
+        }
+    };
 
-std::ostream& Expr::dot(std::ostream& o) const {
+    // bind shared Expr%s in post-order, so each binding only refers to earlier ones - except for back edges in cycles
     ExprSet done;
-    std::queue<const Expr*> q;
-
-    auto enqueue = [&q, &done](const Expr* expr) {
-        if (done.emplace(expr).second) q.emplace(expr);
+    std::vector<std::pair<const Expr*, size_t>> stack; // Expr + next operand to visit
+    auto visit = [&](const Expr* e) {
+        if (e && !is_leaf(e) && done.emplace(e).second) stack.emplace_back(e, 0);
     };
-
-    enqueue(this);
-
-    o << "digraph A {" << std::endl;;
-
-    while (!q.empty()) {
-        auto expr = q.front();
-        q.pop();
-
-        for (auto op : expr->ops) {
-            if (op) {
-                o << std::format("\t{} -> {}[color=black];\n", expr->str_rep(), op->str_rep());
-                enqueue(op);
+    visit(this);
+    while (!stack.empty()) {
+        auto& [e, i] = stack.back();
+        if (i != e->num_ops) {
+            visit(e->op(i++)); // may invalidate e and i
+        } else {
+            auto x = e;
+            stack.pop_back();
+            if (is_bound(x)) {
+                o << "let _" << x->gid << " = ";
+                body(x);
+                o << '\n';
             }
         }
     }
 
-    done.clear();
-    enqueue(this);
-
-    while (!q.empty()) {
-        auto expr = q.front();
-        q.pop();
-        auto aux = expr->str_aux();
+    if (is_bound(this)) return o << '_' << gid;
+    body(this);
+    return o;
+}
 
-        if (auto p = expr->splay_parent()) o << std::format("\t{} -> {}[style=dashed];\n",            aux, p->str_aux());
-        if (auto p = expr->path_parent())  o << std::format("\t{} -> {}[style=dashed,color=gray];\n", aux, p->str_aux());
-        if (auto l = expr->left())         o << std::format("\t{} -> {}[color=green];\n",             aux, l->str_aux());
-        if (auto r = expr->right())        o << std::format("\t{} -> {}[color=red];\n",               aux, r->str_aux());
+std::ostream& Expr::dump() const { return dump(std::cout) << std::endl; }
 
-        for (auto op : expr->ops)
-            if (op) enqueue(op);
-        if (auto l = expr->left_ ) enqueue(l);
-        if (auto r = expr->right_) enqueue(r);
-    }
+void Expr::dot() const {
+    static std::atomic<size_t> i = 0;
+    dot("out" + std::to_string(i.fetch_add(1, std::memory_order_relaxed)) + ".dot");
+}
 
-    return o << "}" << std::endl;;
+void Expr::dot(std::string name) const {
+    std::ofstream ofs(name);
+    dot(ofs);
 }
+
+std::ostream& Expr::dot(std::ostream& o) const { return DotWriter().write(o, this); }
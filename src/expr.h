@@ -1,20 +1,23 @@
 #pragma once
 
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
 
+#include <iterator>
 #include <ostream>
+#include <ranges>
 #include <span>
 #include <string>
-#include <unordered_set>
-#include <unordered_map>
-#include <vector>
 
+#include "arena.h"
+#include "flat_hash.h"
+#include "hash.h"
 #include "link_cut_tree.h"
 
 struct World;
 
-enum class Tag {
+enum class Tag : uint8_t {
     Lit, Id,            // 0-ary
     Minus, Plus,        // unary
     Add, Sub, Mul, Eq,  // binary
@@ -25,9 +28,23 @@ enum class Tag {
 
 std::string tag2str(Tag);
 
+/// Number of operands of an Expr with @p tag.
+constexpr size_t arity(Tag tag) {
+    switch (tag) {
+        case Tag::Lit:
+        case Tag::Id: return 0;
+        case Tag::Minus:
+        case Tag::Plus:
+        case Tag::BB: return 1;
+        case Tag::Select:
+        case Tag::Br: return 3;
+        default: return 2;
+    }
+}
+
 template<class T>
 struct GIDHash {
-    size_t operator()(T p) const { return p->gid; }; // TODO bad hash function
+    size_t operator()(T p) const { return hash_mix(p->gid); };
 };
 
 template<class T>
@@ -40,22 +57,179 @@ struct GIDLt {
     bool operator()(T a, T b) const { return a->gid < b->gid; }
 };
 
-struct Expr : public LinkCutTree<const Expr> {
-    Expr(World&, Tag tag, std::span<const Expr*> ops, uint64_t stuff = 0);
-    Expr(World&);
+/// Node of the expression graph.
+/// Lives in the Arena of a World::Shard and is laid out compactly:
+/// * the aux pointers and path aggregates inherited from LinkCutTree come first - within the first 64 bytes -
+///     followed by the subtree aggregates and the packed header (Expr::gid, Expr::tag, Expr::mut);
+/// * one Expr::Use per operand follows right after the Expr; these thread all users of an Expr through its *use-list*;
+/// * the operands are stored *inline* after the Use%s; use Expr::ops to access them.
+///
+/// Each Expr carries an `int32_t` LinkCutTree::value (`0` by default) that is summed up in `int64_t` along *rep* paths:
+/// `e->path_aggregate()` yields the sum and the number of nodes from `e` up to its root.
+/// Likewise, `e->subtree_aggregate()` yields the sum and the number of nodes in the *rep* subtree of `e`, e.g.,
+/// to estimate the cost of inlining `e` or - with a value of `1` for each Tag::Id - to count its free variables.
+/// @note The *rep* tree is a spanning forest of the DAG: a shared Expr only counts below its *rep* parent.
+struct Expr : public LinkCutTree<const Expr, agg::SubtreeSum<int32_t, int64_t>> {
+    Expr(uint32_t gid, Tag tag, std::span<const Expr* const> ops, uint64_t stuff, size_t hash);
+    Expr(uint32_t gid, size_t hash); ///< Creates a Tag::BB.
+
+    /// Occurrence of an Expr as operand Use::index of Use::user.
+    /// Takes 16 bytes: Use::user is derived from the address of the Use, as the Use%s of an Expr follow right after it,
+    /// and Use::index lives in the top byte of the Use::prev link - user-space addresses don't need more than 56 bits.
+    struct Use {
+        explicit Use(size_t index)
+            : bits_(uintptr_t(index) << Index_Shift) {}
+
+        const Expr* user() const { return reinterpret_cast<const Expr*>(this - index()) - 1; }
+        size_t index() const { return size_t(bits_ >> Index_Shift); }
+        /// Use::next of the previous Use or the head of the use-list; `nullptr` if not in any list.
+        Use** prev() const { return reinterpret_cast<Use**>(bits_ & Prev_Mask); }
+        void set_prev(Use** prev) {
+            assert((reinterpret_cast<uintptr_t>(prev) & ~Prev_Mask) == 0 && "address needs more than 56 bits");
+            bits_ = (bits_ & ~Prev_Mask) | reinterpret_cast<uintptr_t>(prev);
+        }
+
+        Use* next = nullptr;
+
+    private:
+        static constexpr unsigned Index_Shift = 56;
+        static constexpr uintptr_t Prev_Mask  = (uintptr_t(1) << Index_Shift) - 1;
+
+        uintptr_t bits_; ///< Use::prev in the low 56 bits and Use::index in the top byte.
+    };
+
+    /// Forward range over a use-list: newest Use first.
+    class Uses {
+    public:
+        class iterator {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using difference_type   = std::ptrdiff_t;
+            using value_type        = Use;
+            using pointer           = const Use*;
+            using reference         = const Use&;
+
+            iterator(const Use* use = nullptr)
+                : use_(use) {}
+
+            reference operator*() const { return *use_; }
+            pointer operator->() const { return use_; }
+            iterator& operator++() {
+                use_ = use_->next;
+                return *this;
+            }
+            iterator operator++(int) {
+                auto res = *this;
+                ++*this;
+                return res;
+            }
+            bool operator==(const iterator&) const = default;
+
+        private:
+            const Use* use_;
+        };
+
+        Uses(const Use* first)
+            : first_(first) {}
+        iterator begin() const { return first_; }
+        iterator end() const { return {}; }
+        bool empty() const { return !first_; }
+
+    private:
+        const Use* first_;
+    };
+
+    /// Number of bytes needed for an Expr with @p num_ops operands.
+    /// Arena rounds this up to whole cache lines: 128, 192, 192, and 192 bytes for 0 - 3 operands.
+    static constexpr size_t size_of(size_t num_ops) { return sizeof(Expr) + num_ops * (sizeof(const Expr*) + sizeof(Use)); }
+
+    World& world() const;
+
+    /// @name Operands
+    ///@{
+    std::span<const Expr* const> ops() const { return {reinterpret_cast<const Expr* const*>(use_slots().data() + num_ops), num_ops}; }
+    const Expr* op(size_t i) const { return ops()[i]; }
+    ///@}
 
     void set(const Expr* e) {
-        assert(ops.size() == 1);
-        assert(ops[0] == nullptr);
-        ops[0] = e;
+        assert(num_ops == 1);
+        assert(op(0) == nullptr);
+        set_op(0, e);
         link(e);
     }
 
+    /// @name Uses
+    /// World links the Use%s of an immutable Expr into the use-lists of its operands right when it links the Expr itself;
+    /// Expr::set_op keeps them in sync afterwards. A use-list doesn't own anything: all Use%s live inline in their users.
+    /// Iterating them is O(uses), while adding or removing a single Use is O(1).
+    /// @sa World::replace_all_uses_with
+    ///@{
+    Uses uses() const { return first_use_; }
+    size_t num_uses() const { return size_t(std::ranges::distance(uses())); }
+    /// Adds each Use of `this` to the use-list of its operand.
+    void add_uses() {
+        for (size_t i = 0; i != num_ops; ++i)
+            if (auto op = this->op(i)) push_use(op, use_slots()[i]);
+    }
+    /// Removes each Use of `this` from the use-list of its operand, e.g., before `this` dies.
+    void remove_uses() {
+        for (auto& use : use_slots()) pop_use(use);
+    }
+    ///@}
+
+    /// @name Journaling
+    /// While a World::checkpoint is active on this thread, World::rollback can undo these writes.
+    ///@{
+    /// Overwrites operand @p i in place and moves its Use to the use-list of @p e - without rehashing or relinking `this`.
+    void set_op(size_t i, const Expr* e) {
+        if (speculating) [[unlikely]]
+            journal_op(i);
+        // a non-null operand whose Use is in no list belongs to an Expr that World hasn't linked yet
+        auto& use = use_slots()[i];
+        if (use.prev() || !op(i)) {
+            pop_use(use);
+            if (e) push_use(e, use);
+        }
+        ops()[i] = e;
+    }
+    /// Write hook of LinkCutTree: saves the *aux* part of `this` before its first change since the last World::checkpoint.
+    void on_write() const {
+        if (speculating) [[unlikely]]
+            journal_aux();
+    }
+    /// World with an active World::checkpoint on this thread, if any.
+    static inline thread_local World* speculating = nullptr;
+    ///@}
+
+    /// @name Hash-Consing
+    /// These work on the *key* of an immutable Expr - its Expr::tag, Expr::ops, and Expr::stuff -
+    /// so World can probe for an existing node without constructing a new one first.
+    /// Expr::hash_of combines the Expr::hash%es of the @p ops - not their Expr::gid%s:
+    /// it only depends on the content of the whole DAG, no matter in which order it has been built.
+    ///@{
+    static size_t hash_of(Tag, std::span<const Expr* const> ops, uint64_t stuff);
+    static bool equal(Tag, std::span<const Expr* const> ops, uint64_t stuff, const Expr*);
     static bool equal(const Expr*, const Expr*);
+    ///@}
+
+    /// Total order that - unlike Expr::gid - does not depend on the order of construction:
+    /// by Expr::hash and, on collisions, by Expr::tag, Expr::stuff, and Expr::ops.
+    /// Only Tag::BB%s with colliding hashes fall back to their Expr::gid.
+    static bool less(const Expr*, const Expr*);
+
+    /// @name Textual Output
+    /// Prints `this` as S-expression, e.g. `(+ x (* y 2))`, in time and space linear in the number of distinct Expr%s:
+    /// * Shared Expr%s and Tag::BB%s are printed once as `let _<gid> = ...` binding and referred to as `_<gid>` afterwards.
+    /// * The bindings come in post-order, so they only refer to earlier ones - except for the back edges of a loop.
+    /// * Both the traversal and the output use explicit stacks, so arbitrarily deep Expr%s don't overflow the call stack.
+    ///@{
     std::ostream& dump(std::ostream&) const;
     std::ostream& dump() const;
+    ///@}
 
     /// @name GraphViz' Dot output
+    /// Writes both views of DotWriter without limits; use a DotWriter directly for more control.
+    /// Without arguments, the output goes to `out<n>.dot` where `n` counts these dumps across the whole process.
     ///@{
     void dot() const;
     void dot(std::string) const;
@@ -67,33 +241,52 @@ struct Expr : public LinkCutTree<const Expr> {
     std::string str_rep() const { return str_(false); }
     std::string str_aux() const { return str_(true); }
 
-    void aggregate_link(const Expr* up) const { up->agg += this->agg; }
-    void aggregate_cut(const Expr* up) const { up->agg -= this->agg; }
-    void aggregate() const {
-#if 0
-        agg = gid;
-        for (auto op : ops) agg += op->agg;
-#endif
-    }
-
     template<bool flip = false>
-    void splay_link(const Expr* p) const {
-        *(flip ? &p->right_ : &p->left_) = this;
-        this->parent_                    = p;
-    }
+    void splay_link(const Expr* p) const { set_child(p, flip, this); }
 
-    using LinkCutTree<const Expr>::splay;
+    using LinkCutTree::splay;
 
-    World& world;
-    size_t gid;
-    bool mut;
+    uint32_t gid;
     Tag tag;
-    std::vector<const Expr*> ops;
+    bool mut;
+    uint8_t num_ops;
     uint64_t stuff;
     size_t hash;
-    mutable size_t agg = 0;
+
+private:
+    /// Raw operand slots - bypass the use-lists; outside of construction, go through Expr::set_op.
+    std::span<const Expr*> ops() { return {reinterpret_cast<const Expr**>(use_slots().data() + num_ops), num_ops}; }
+    std::span<Use> use_slots() const { return {reinterpret_cast<Use*>(const_cast<Expr*>(this) + 1), num_ops}; }
+    static void push_use(const Expr* e, Use& use) {
+        use.next = e->first_use_;
+        use.set_prev(&e->first_use_);
+        if (use.next) use.next->set_prev(&use.next);
+        e->first_use_ = &use;
+    }
+    static void pop_use(Use& use) {
+        auto prev = use.prev();
+        if (!prev) return;
+        *prev = use.next;
+        if (use.next) use.next->set_prev(prev);
+        use.next = nullptr;
+        use.set_prev(nullptr);
+    }
+
+    void journal_op(size_t i);
+    void journal_aux() const;
+
+    mutable Use* first_use_ = nullptr; ///< Head of the use-list.
+
+    friend struct World;
 };
 
-using ExprSet = std::unordered_set<const Expr*, GIDHash<const Expr*>, GIDEq<const Expr*>>;
+static_assert(Expr::LinkCutTree::hot_size() <= Arena::Align, "aux pointers + path aggregates don't fit into the first cache line of an Expr");
+static_assert(sizeof(Expr) == sizeof(Expr::LinkCutTree) + sizeof(uint64_t) + sizeof(uint64_t) + sizeof(size_t) + sizeof(void*),
+              "Expr::gid, Expr::tag, Expr::mut, and Expr::num_ops must share one word and Expr must not be padded");
+static_assert(Expr::size_of(UINT8_MAX) <= Arena::Max_Size, "an Expr with the maximum number of operands doesn't fit into an Arena page");
+static_assert(sizeof(Expr::Use) == 16 && sizeof(Expr) % alignof(Expr::Use) == 0 && sizeof(Expr::Use) % alignof(const Expr*) == 0,
+              "the Use%s must follow the Expr seamlessly and the operands the Use%s");
+
+using ExprSet = FlatSet<const Expr*, GIDHash<const Expr*>, GIDEq<const Expr*>>;
 template<class T>
-using ExprMap = std::unordered_map<const Expr*, T, GIDHash<const Expr*>, GIDEq<const Expr*>>;
+using ExprMap = FlatMap<const Expr*, T, GIDHash<const Expr*>, GIDEq<const Expr*>>;
@@ -0,0 +1,327 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+
+#include <algorithm>
+#include <bit>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+namespace detail {
+
+template<class K>
+struct SetTraits {
+    using Key   = K;
+    using Value = K;
+    static const K& key(const Value& value) { return value; }
+};
+
+template<class K, class V>
+struct MapTraits {
+    using Key   = K;
+    using Value = std::pair<K, V>;
+    static const K& key(const Value& value) { return value.first; }
+};
+
+/// Open-addressing hash table using [Robin Hood hashing](https://programming.guide/robin-hood-hashing.html)
+/// with backward-shift deletion.
+/// * One byte of metadata per slot holds the distance of its element to the element's home slot plus one (`0` means empty).
+///     A lookup stops as soon as it meets a slot that is closer to home than the lookup itself.
+/// * Each slot caches the full hash of its element:
+///     keys are only compared on a hash match and growing the table never invokes @p H again.
+/// * @p H and @p E may be [transparent](https://en.cppreference.com/w/cpp/container/unordered_set/find),
+///     i.e. find/contains/erase accept anything @p H and @p E can deal with.
+///
+/// @note `Value`s must be default-constructible; empty slots hold a default-constructed `Value`.
+/// @warning Inserting and erasing invalidates all iterators.
+template<class Traits, class H, class E>
+class RobinHood {
+public:
+    using Key   = typename Traits::Key;
+    using Value = typename Traits::Value;
+
+    static constexpr size_t Min_Capacity = 16;
+
+    struct Stats {
+        size_t size;
+        size_t capacity;
+        size_t num_displaced; ///< Number of elements that do not live in their home slot.
+        size_t max_probe;     ///< Longest probe sequence of a successful lookup.
+        double avg_probe;     ///< Average probe length of a successful lookup.
+        size_t num_bytes;     ///< Memory held by the table.
+    };
+
+    template<bool Const>
+    class Iter {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using difference_type   = std::ptrdiff_t;
+        using value_type        = Value;
+        using Table             = std::conditional_t<Const, const RobinHood, RobinHood>;
+        using reference         = std::conditional_t<Const, const Value&, Value&>;
+        using pointer           = std::conditional_t<Const, const Value*, Value*>;
+
+        Iter() = default;
+        Iter(Table* table, size_t i)
+            : table_(table)
+            , i_(i) {
+            skip();
+        }
+        operator Iter<true>() const requires (!Const) { return {table_, i_}; }
+
+        reference operator*() const { return table_->slots_[i_].value; }
+        pointer operator->() const { return &**this; }
+        Iter& operator++() { return ++i_, skip(), *this; }
+        Iter operator++(int) {
+            auto res = *this;
+            ++*this;
+            return res;
+        }
+        bool operator==(const Iter&) const = default;
+
+    private:
+        void skip() {
+            while (i_ != table_->capacity_ && table_->meta_[i_] == 0) ++i_;
+        }
+
+        Table* table_ = nullptr;
+        size_t i_     = 0;
+
+        friend class RobinHood;
+    };
+
+    using iterator       = Iter<false>;
+    using const_iterator = Iter<true>;
+
+    /// @name Construction
+    ///@{
+    RobinHood() = default;
+    RobinHood(const RobinHood& other) {
+        reserve(other.size());
+        for (size_t i = 0; i != other.capacity_; ++i)
+            if (other.meta_[i]) insert_new(other.slots_[i].hash, Value(other.slots_[i].value));
+    }
+    RobinHood(RobinHood&& other) noexcept { swap(*this, other); }
+    RobinHood& operator=(RobinHood other) noexcept { return swap(*this, other), *this; }
+    friend void swap(RobinHood& a, RobinHood& b) noexcept {
+        using std::swap;
+        swap(a.meta_, b.meta_);
+        swap(a.slots_, b.slots_);
+        swap(a.capacity_, b.capacity_);
+        swap(a.size_, b.size_);
+    }
+    ///@}
+
+    /// @name Capacity
+    ///@{
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t capacity() const { return capacity_; }
+    /// Makes room for @p n elements without growing.
+    void reserve(size_t n) {
+        auto cap = std::max(capacity_, Min_Capacity);
+        while (n * 8 > cap * 7) cap *= 2;
+        if (cap != capacity_) rehash(cap);
+    }
+    ///@}
+
+    /// @name Iterators
+    ///@{
+    iterator begin() { return {this, 0}; }
+    iterator end() { return {this, capacity_}; }
+    const_iterator begin() const { return {this, 0}; }
+    const_iterator end() const { return {this, capacity_}; }
+    ///@}
+
+    /// @name Lookup
+    ///@{
+    template<class Q>
+    iterator find(const Q& q) {
+        return {this, find_index(q)};
+    }
+    template<class Q>
+    const_iterator find(const Q& q) const {
+        return {this, find_index(q)};
+    }
+    template<class Q>
+    bool contains(const Q& q) const {
+        return find_index(q) != capacity_;
+    }
+    template<class Q>
+    size_t count(const Q& q) const {
+        return contains(q) ? 1 : 0;
+    }
+    /// Number of slots a lookup of the element at @p i inspects.
+    size_t probe_length(const_iterator i) const { return meta_[i.i_]; }
+    ///@}
+
+    /// @name Modifiers
+    ///@{
+    std::pair<iterator, bool> insert(Value value) {
+        const auto& key = Traits::key(value);
+        if (auto i = find_index(key); i != capacity_) return {{this, i}, false};
+        auto h = hash(key);
+        return {{this, insert_new(h, std::move(value))}, true};
+    }
+
+    template<class... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        return insert(Value(std::forward<Args>(args)...));
+    }
+
+    /// Inserts @p value which must **not** be in the table yet; this skips all key comparisons.
+    iterator insert_unique(Value value) {
+        auto h = hash(Traits::key(value));
+        return {this, insert_new(h, std::move(value))};
+    }
+
+    template<class Q>
+    size_t erase(const Q& q) {
+        auto i = find_index(q);
+        if (i == capacity_) return 0;
+        erase_index(i);
+        return 1;
+    }
+
+    /// @returns the element that now occupies the erased slot's position or any later one.
+    iterator erase(const_iterator i) {
+        erase_index(i.i_);
+        return {this, i.i_};
+    }
+    iterator erase(iterator i) { return erase(const_iterator(i)); }
+
+    void clear() {
+        for (size_t i = 0; i != capacity_; ++i) {
+            if (meta_[i]) {
+                meta_[i]        = 0;
+                slots_[i].value = Value();
+            }
+        }
+        size_ = 0;
+    }
+    ///@}
+
+    Stats stats() const {
+        Stats s = {size_, capacity_, 0, 0, 0.0, capacity_ * (sizeof(uint8_t) + sizeof(Slot))};
+        size_t sum = 0;
+        for (size_t i = 0; i != capacity_; ++i) {
+            if (auto d = meta_[i]) {
+                if (d > 1) ++s.num_displaced;
+                s.max_probe = std::max(s.max_probe, size_t(d));
+                sum += d;
+            }
+        }
+        s.avg_probe = size_ ? double(sum) / double(size_) : 0.0;
+        return s;
+    }
+
+protected:
+    struct Slot {
+        size_t hash = 0;
+        Value value = {};
+    };
+
+    static constexpr size_t Max_Dist = 255; ///< Larger distances don't fit into meta_ - grow instead.
+
+    template<class Q>
+    static size_t hash(const Q& q) {
+        return H()(q);
+    }
+
+    template<class Q>
+    size_t find_index(const Q& q) const {
+        if (size_ == 0) return capacity_;
+        auto h    = hash(q);
+        auto mask = capacity_ - 1;
+        for (size_t i = h & mask, d = 1; meta_[i] >= d; i = (i + 1) & mask, ++d)
+            if (slots_[i].hash == h && E()(q, Traits::key(slots_[i].value))) return i;
+        return capacity_;
+    }
+
+    size_t insert_new(size_t h, Value&& value) {
+        if ((size_ + 1) * 8 > capacity_ * 7) rehash(std::max(capacity_ * 2, Min_Capacity));
+
+        auto key  = Traits::key(value);
+        auto mask = capacity_ - 1;
+        auto slot = Slot{h, std::move(value)};
+        size_t res = capacity_;
+
+        for (size_t i = slot.hash & mask, d = 1;; i = (i + 1) & mask, ++d) {
+            if (d > Max_Dist) { // pathological clustering: grow and start over with what's left in our hands
+                assert(size_ * 16 > capacity_ && "more than Max_Dist elements with the same hash?");
+                rehash(capacity_ * 2);
+                insert_new(slot.hash, std::move(slot.value));
+                return find_index(key);
+            }
+
+            if (meta_[i] == 0) {
+                meta_[i]  = uint8_t(d);
+                slots_[i] = std::move(slot);
+                ++size_;
+                return res == capacity_ ? i : res;
+            }
+
+            if (meta_[i] < d) { // steal from the rich: slot i is closer to home than we are
+                std::swap(slots_[i], slot);
+                d = std::exchange(meta_[i], uint8_t(d));
+                if (res == capacity_) res = i;
+            }
+        }
+    }
+
+    void erase_index(size_t i) {
+        auto mask = capacity_ - 1;
+        for (size_t j = (i + 1) & mask; meta_[j] > 1; i = j, j = (j + 1) & mask) {
+            meta_[i]  = meta_[j] - 1;
+            slots_[i] = std::move(slots_[j]);
+        }
+        meta_[i]        = 0;
+        slots_[i].value = Value();
+        --size_;
+    }
+
+    void rehash(size_t cap) {
+        assert(std::has_single_bit(cap));
+        auto old_meta  = std::exchange(meta_, std::make_unique<uint8_t[]>(cap));
+        auto old_slots = std::exchange(slots_, std::make_unique<Slot[]>(cap));
+        auto old_cap   = std::exchange(capacity_, cap);
+        size_          = 0;
+        for (size_t i = 0; i != old_cap; ++i)
+            if (old_meta[i]) insert_new(old_slots[i].hash, std::move(old_slots[i].value));
+    }
+
+    std::unique_ptr<uint8_t[]> meta_;
+    std::unique_ptr<Slot[]> slots_;
+    size_t capacity_ = 0;
+    size_t size_     = 0;
+};
+
+} // namespace detail
+
+/// Flat hash set; see detail::RobinHood.
+template<class K, class H, class E = std::equal_to<K>>
+using FlatSet = detail::RobinHood<detail::SetTraits<K>, H, E>;
+
+/// Flat hash map; see detail::RobinHood.
+template<class K, class V, class H, class E = std::equal_to<K>>
+class FlatMap : public detail::RobinHood<detail::MapTraits<K, V>, H, E> {
+public:
+    using Super = detail::RobinHood<detail::MapTraits<K, V>, H, E>;
+    using Super::Super;
+
+    V& operator[](const K& key) {
+        if (auto i = this->find_index(key); i != this->capacity_) return this->slots_[i].value.second;
+        auto i = this->insert_new(Super::hash(key), {key, V()});
+        return this->slots_[i].value.second;
+    }
+
+    template<class... Args>
+    std::pair<typename Super::iterator, bool> emplace(const K& key, Args&&... args) {
+        if (auto i = this->find_index(key); i != this->capacity_) return {{this, i}, false};
+        auto i = this->insert_new(Super::hash(key), {key, V(std::forward<Args>(args)...)});
+        return {{this, i}, true};
+    }
+};
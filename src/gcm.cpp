@@ -0,0 +1,244 @@
+#include "gcm.h"
+
+#include <algorithm>
+#include <bit>
+#include <functional>
+#include <ranges>
+#include <utility>
+
+#include "world.h"
+
+static constexpr GCM::Index Pending = GCM::Nil - 1; ///< On the DFS stack of GCM::visit.
+
+GCM::GCM(const DomTree& dom, std::span<const std::pair<const Expr*, const Expr*>> params)
+    : dom_(dom) {
+    discover();
+    bind(params);
+    build_jumps();
+    find_loops();
+    build_best();
+    place();
+}
+
+/*
+ * discover
+ */
+
+/// Walks the body of each reachable BB in BFS order, collects the pure Expr%s, and seeds their GCM::late with that BB.
+void GCM::discover() {
+    auto entry = dom_.entry();
+    size_t n   = entry->world().gid;
+    block_.assign(n, Nil);
+    node_.assign(n, Nil);
+
+    std::vector<Index> mark(n, Nil); // Expr::gid -> last Block whose body has reached this Expr
+    std::vector<const Expr*> stack;
+    block_[entry->gid] = 0;
+    blocks_.emplace_back(entry);
+
+    for (Index b = 0; b != blocks_.size(); ++b) {
+        stack.clear();
+        if (auto body = blocks_[b].bb->op(0)) stack.emplace_back(body);
+
+        while (!stack.empty()) {
+            auto e = stack.back();
+            stack.pop_back();
+            if (std::exchange(mark[e->gid], b) == b || is_leaf(e)) continue;
+
+            if (e->tag == Tag::BB) {
+                assert(dom_.is_reachable(e) && "DomTree is out of sync");
+                auto& s = block_[e->gid];
+                if (s == Nil) {
+                    s = Index(blocks_.size());
+                    blocks_.emplace_back(e);
+                }
+                blocks_[s].preds.emplace_back(b);
+            } else if (is_pinned(e)) {
+                for (auto op : e->ops())
+                    if (op) stack.emplace_back(op);
+            } else {
+                auto& node = nodes_[visit(e)];
+                node.late  = lca(node.late, b);
+            }
+        }
+    }
+
+    // a dominator is closer to the entry and hence comes first in BFS order
+    for (auto& block : blocks_) {
+        if (auto idom = dom_.idom(block.bb)) {
+            block.idom  = block_index(idom);
+            block.depth = blocks_[block.idom].depth + 1;
+        }
+    }
+}
+
+/// Pins each parameter to the reachable BB that receives it.
+void GCM::bind(std::span<const std::pair<const Expr*, const Expr*>> params) {
+    for (auto [bb, param] : params) {
+        assert(bb->tag == Tag::BB && param->tag == Tag::Id);
+        if (bb->gid < block_.size() && param->gid < block_.size()) block_[param->gid] = block_[bb->gid];
+    }
+}
+
+/// Iterative post-order DFS along the pure operands of @p root; @returns the index of @p root into nodes_.
+GCM::Index GCM::visit(const Expr* root) {
+    if (auto i = node_[root->gid]; i != Nil) return i;
+
+    std::vector<std::pair<const Expr*, size_t>> stack; // Expr + next operand to visit
+    node_[root->gid] = Pending;
+    stack.emplace_back(root, 0);
+    while (!stack.empty()) {
+        auto& [e, i] = stack.back();
+        if (i != e->num_ops) {
+            auto op = e->op(i++);
+            if (op && !is_leaf(op) && op->tag != Tag::BB && !is_pinned(op) && node_[op->gid] == Nil) {
+                node_[op->gid] = Pending;
+                stack.emplace_back(op, 0); // invalidates e and i
+            }
+        } else {
+            node_[e->gid] = Index(nodes_.size());
+            nodes_.emplace_back(e);
+            stack.pop_back();
+        }
+    }
+    return node_[root->gid];
+}
+
+/*
+ * loops
+ */
+
+/// Finds the natural loops innermost first - by decreasing depth of their headers - and walks each loop backwards
+/// from its back edges; an inner loop that is already known is skipped over in one step via its outermost enclosing loop.
+void GCM::find_loops() {
+    std::vector<Index> headers;
+    for (Index b = 0; b != blocks_.size(); ++b)
+        if (std::ranges::any_of(blocks_[b].preds, [&](Index p) { return dominates(b, p); }))
+            headers.emplace_back(b);
+    std::ranges::stable_sort(headers, std::greater{}, [&](Index h) { return blocks_[h].depth; });
+
+    std::vector<Index> loop(blocks_.size(), Nil); // Block -> innermost loop, i.e. index into headers
+    std::vector<Index> parent(headers.size(), Nil), outer(headers.size());
+    auto outermost = [&](Index l) { // union-find with path halving
+        while (outer[l] != l) l = outer[l] = outer[outer[l]];
+        return l;
+    };
+
+    std::vector<Index> todo;
+    for (Index l = 0; l != headers.size(); ++l) {
+        auto h   = headers[l];
+        outer[l] = l;
+        loop[h]  = l;
+        todo.clear();
+        for (auto p : blocks_[h].preds)
+            if (dominates(h, p)) todo.emplace_back(p);
+
+        while (!todo.empty()) {
+            auto b = todo.back();
+            todo.pop_back();
+            if (loop[b] == Nil) {
+                loop[b] = l;
+                todo.insert(todo.end(), blocks_[b].preds.begin(), blocks_[b].preds.end());
+            } else if (auto sub = outermost(loop[b]); sub != l) {
+                parent[sub] = outer[sub] = l;
+                todo.insert(todo.end(), blocks_[headers[sub]].preds.begin(), blocks_[headers[sub]].preds.end());
+            }
+        }
+    }
+
+    // outer loops come after their inner ones in headers
+    std::vector<uint32_t> depth(headers.size());
+    for (Index l = Index(headers.size()); l-- != 0;) depth[l] = parent[l] == Nil ? 1 : depth[parent[l]] + 1;
+    for (Index b = 0; b != blocks_.size(); ++b)
+        if (loop[b] != Nil) blocks_[b].loop_depth = depth[loop[b]];
+}
+
+/*
+ * dominator tree
+ */
+
+void GCM::build_jumps() {
+    size_t max_depth = 0;
+    for (auto& block : blocks_) max_depth = std::max(max_depth, block.depth);
+    auto num_levels = std::bit_width(max_depth + 1); // GCM::best covers up to max_depth + 1 BB%s
+
+    jump_.assign(num_levels, std::vector<Index>(blocks_.size(), Nil));
+    for (Index b = 0; b != blocks_.size(); ++b) jump_[0][b] = blocks_[b].idom;
+    for (size_t k = 1; k != num_levels; ++k) {
+        for (Index b = 0; b != blocks_.size(); ++b) {
+            auto mid    = jump_[k - 1][b];
+            jump_[k][b] = mid == Nil ? Nil : jump_[k - 1][mid];
+        }
+    }
+}
+
+/// Needs the loop depths, so this comes after GCM::find_loops.
+void GCM::build_best() {
+    auto better = [&](Index a, Index b) { return blocks_[b].loop_depth < blocks_[a].loop_depth ? b : a; };
+    best_.assign(jump_.size(), std::vector<Index>(blocks_.size(), Nil));
+    for (Index b = 0; b != blocks_.size(); ++b) best_[0][b] = b;
+    for (size_t k = 1; k != jump_.size(); ++k) {
+        for (Index b = 0; b != blocks_.size(); ++b) {
+            auto mid    = jump_[k - 1][b];
+            best_[k][b] = mid == Nil ? best_[k - 1][b] : better(best_[k - 1][b], best_[k - 1][mid]);
+        }
+    }
+}
+
+/// Climbs from @p b to the depth of @p a along the jump pointers;
+/// unlike DomTree::dominates, this doesn't restructure the LinkCutTree, which matters for the many back edge checks.
+bool GCM::dominates(Index a, Index b) const {
+    if (blocks_[b].depth < blocks_[a].depth) return false;
+    auto len = blocks_[b].depth - blocks_[a].depth;
+    for (size_t k = 0; len != 0; ++k, len >>= 1)
+        if (len & 1) b = jump_[k][b];
+    return a == b;
+}
+
+/*
+ * placement
+ */
+
+GCM::Index GCM::lca(Index a, Index b) const {
+    if (a == Nil) return b;
+    return block_index(dom_.lca(bb(a), bb(b)));
+}
+
+/// Combines the power-of-two stretches from @p late up to and including @p early; ties go to the deeper BB.
+GCM::Index GCM::best(Index late, Index early) const {
+    auto res = Nil;
+    auto len = blocks_[late].depth - blocks_[early].depth + 1;
+    for (size_t k = 0; len != 0; ++k, len >>= 1) {
+        if (len & 1) {
+            auto b = best_[k][late];
+            if (res == Nil || blocks_[b].loop_depth < blocks_[res].loop_depth) res = b;
+            late = jump_[k][late];
+        }
+    }
+    return res;
+}
+
+void GCM::place() {
+    // early: operands come first in nodes_; parameters are pinned to their BB
+    for (auto& node : nodes_) {
+        node.early = 0;
+        for (auto op : node.expr->ops()) {
+            if (!op || op->gid >= node_.size()) continue;
+            auto e = node_[op->gid] != Nil ? nodes_[node_[op->gid]].early : op->tag == Tag::Id ? block_[op->gid] : Nil;
+            if (e != Nil && blocks_[e].depth > blocks_[node.early].depth) node.early = e;
+        }
+    }
+
+    // late & block: users come first in reverse
+    for (auto& node : nodes_ | std::views::reverse) {
+        assert(node.late != Nil && dominates(node.early, node.late));
+        node.block = best(node.late, node.early);
+        for (auto op : node.expr->ops()) {
+            if (!op || op->gid >= node_.size() || node_[op->gid] == Nil) continue;
+            auto& late = nodes_[node_[op->gid]].late;
+            late       = lca(late, node.block);
+        }
+    }
+
+    for (auto& node : nodes_) blocks_[node.block].schedule.emplace_back(node.expr);
+}
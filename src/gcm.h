@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "dom.h"
+
+/// [Global Code Motion](https://doi.org/10.1145/207110.207154) (Click, 1995):
+/// places each pure Expr that the reachable BB%s of a DomTree use into one of these BB%s.
+/// * *Pinned* are Tag::Jmp and Tag::Br: they belong to each BB whose body reaches them without passing through another BB.
+///     So are the *parameters* of a BB - the Tag::Id%s that receive the values its predecessors pass via Tag::Jmp, e.g.,
+///     a loop variable: they are defined in their BB and hence not available before it.
+///     All other Expr%s are *pure*; Tag::Lit and the remaining Tag::Id%s are available everywhere and hence not placed at all.
+/// * GCM::early is the deepest BB - in the DomTree - among the early BB%s of an Expr's operands
+///     (the BB of a parameter and DomTree::entry for other leaves).
+///     GCM::late is the DomTree::lca of all BB%s that use the Expr - either directly from a pinned Expr or via another pure Expr
+///     in the BB where the latter ends up.
+/// * GCM::block is the BB on the dominator path from GCM::late up to GCM::early with the smallest GCM::loop_depth;
+///     among those, the deepest one. This hoists loop-invariant code without moving anything further than necessary.
+///     To answer these path queries in O(log n), GCM keeps jump pointers with the best BB for each power-of-two stretch;
+///     these also decide dominance for the back edge checks below.
+/// * GCM::loop_depth counts the *natural loops* - back edges to a dominating header - that contain a BB.
+///     Retreating edges to a BB that doesn't dominate their source (irreducible control flow) are ignored.
+///
+/// All in all, GCM runs in O((n + m) log n) for n BB%s and pure Expr%s and m operand edges.
+/// The result is a snapshot: rerun GCM after mutating Expr::ops.
+class GCM {
+public:
+    using Index                = uint32_t;
+    static constexpr Index Nil = Index(-1);
+
+    /// @p params binds each parameter - a Tag::Id - to its BB as `{bb, param}` pair;
+    /// parameters of unreachable BB%s are ignored.
+    GCM(const DomTree& dom, std::span<const std::pair<const Expr*, const Expr*>> params = {});
+
+    /// @name Getters
+    /// @p e must be a pure Expr that is used by a reachable BB.
+    ///@{
+    const DomTree& dom() const { return dom_; }
+    const Expr* early(const Expr* e) const { return bb(node(e).early); }
+    const Expr* late(const Expr* e) const { return bb(node(e).late); }
+    const Expr* block(const Expr* e) const { return bb(node(e).block); }
+    /// Number of natural loops that contain @p bb; @p bb must be reachable.
+    size_t loop_depth(const Expr* bb) const { return blocks_[block_index(bb)].loop_depth; }
+    /// All pure Expr%s placed in @p bb - operands before their users; the body of @p bb comes after these.
+    std::span<const Expr* const> schedule(const Expr* bb) const { return blocks_[block_index(bb)].schedule; }
+    /// Number of placed Expr%s.
+    size_t size() const { return nodes_.size(); }
+    ///@}
+
+private:
+    struct Block {
+        const Expr* bb;
+        size_t depth = 0; ///< DomTree::depth.
+        Index idom = Nil; ///< Index into blocks_.
+        uint32_t loop_depth = 0;
+        std::vector<Index> preds;
+        std::vector<const Expr*> schedule;
+    };
+
+    struct Node {
+        const Expr* expr;
+        Index early = Nil, late = Nil, block = Nil; ///< Indices into blocks_.
+    };
+
+    static bool is_pinned(const Expr* e) { return e->tag == Tag::Jmp || e->tag == Tag::Br; }
+    static bool is_leaf(const Expr* e) { return e->tag == Tag::Lit || e->tag == Tag::Id; }
+
+    const Expr* bb(Index b) const { return blocks_[b].bb; }
+    Index block_index(const Expr* bb) const {
+        auto b = bb->gid < block_.size() ? block_[bb->gid] : Nil;
+        assert(b != Nil && "BB is not reachable from entry");
+        return b;
+    }
+    const Node& node(const Expr* e) const {
+        assert(e->gid < node_.size() && node_[e->gid] != Nil && "Expr has not been placed");
+        return nodes_[node_[e->gid]];
+    }
+
+    void discover();
+    void bind(std::span<const std::pair<const Expr*, const Expr*>> params);
+    Index visit(const Expr* e);
+    void build_jumps();
+    void find_loops();
+    void build_best();
+    bool dominates(Index a, Index b) const;
+    Index lca(Index a, Index b) const;
+    Index best(Index late, Index early) const;
+    void place();
+
+    const DomTree& dom_;
+    std::vector<Block> blocks_;                  ///< Reachable BB%s in BFS order from DomTree::entry.
+    std::vector<Node> nodes_;                    ///< Pure Expr%s in post-order: operands before users.
+    std::vector<Index> block_;                   ///< Expr::gid of a BB or parameter -> index into blocks_ or GCM::Nil.
+    std::vector<Index> node_;                    ///< Expr::gid -> index into nodes_ or GCM::Nil.
+    std::vector<std::vector<Index>> jump_, best_; ///< jump_[k][b]: 2^k-th dominator of b; best_[k][b]: best BB on the way there.
+};
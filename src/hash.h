@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+#include <bit>
+
+/// @name Hashing
+/// Building blocks taken from [MurmurHash3](https://github.com/aappleby/smhasher/blob/master/src/MurmurHash3.cpp).
+/// Unlike plain `^`, hash_combine is order-sensitive, so permuted operands yield different hashes.
+///@{
+
+/// Finalizer: every input bit affects every output bit.
+constexpr uint64_t hash_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64_C(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    return h;
+}
+
+/// Feeds @p v into the running hash @p h; finish with hash_mix.
+constexpr uint64_t hash_combine(uint64_t h, uint64_t v) {
+    v *= UINT64_C(0x87c37b91114253d5);
+    v = std::rotl(v, 31);
+    v *= UINT64_C(0x4cf5ad432745937f);
+    h ^= v;
+    h = std::rotl(h, 27);
+    return h * 5 + 0x52dce729;
+}
+///@}
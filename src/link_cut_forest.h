@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+
+#include <array>
+#include <vector>
+
+/// Non-intrusive, index-based variant of LinkCutTree.
+/// Nodes are dense `uint32_t` handles `0, 1, ...`; the links of the *aux* trees live in separate arrays indexed by them
+/// ([struct of arrays](https://en.wikipedia.org/wiki/AoS_and_SoA)).
+/// Thus, a link takes 4 instead of 8 bytes and rotations only touch these arrays instead of whole nodes.
+/// The semantics of all operations are identical to LinkCutTree (without path aggregates and LinkCutTree::evert); LinkCutForest::Nil plays the role of `nullptr`.
+/// @sa IndexedLinkCutTree to use a LinkCutForest with LinkCutTree's CRTP interface.
+class LinkCutForest {
+public:
+    using Node                = uint32_t;
+    static constexpr Node Nil = Node(-1);
+
+    LinkCutForest(size_t n = 0) { resize(n); }
+
+    size_t size() const { return parent_.size(); }
+    /// Adds/removes nodes at the end; new nodes are singletons.
+    void resize(size_t n) {
+        parent_.resize(n, Nil);
+        child_[0].resize(n, Nil);
+        child_[1].resize(n, Nil);
+    }
+
+    /// @name Getters
+    ///@{
+    Node splay_parent(Node x) const { return is_splay_child(x) ? parent_[x] : Nil; }
+    Node path_parent(Node x) const { return parent_[x] != Nil && !is_splay_child(x) ? parent_[x] : Nil; }
+    Node left(Node x) const { return child_[0][x]; }
+    Node right(Node x) const { return child_[1][x]; }
+    ///@}
+
+    /// Registers the edge @p x -> @p child in the *aux* tree; see LinkCutTree::link.
+    void link(Node x, Node child) {
+        expose(x);
+        expose(child);
+        if (right(child) == Nil) {
+            parent_[x]      = child;
+            child_[1][child] = x;
+        }
+    }
+
+    /// Deregisters the edge @p x -> parent in the *aux* tree; see LinkCutTree::cut.
+    void cut(Node x) {
+        expose(x);
+        if (auto r = right(x); r != Nil) {
+            parent_[r]   = Nil;
+            child_[1][x] = Nil;
+        }
+    }
+
+    /// Make a preferred path from @p x to root while putting @p x at the root of the *aux* tree.
+    /// @returns the last valid LinkCutForest::path_parent.
+    Node expose(Node x) {
+        Node prev = Nil;
+        for (auto curr = x; curr != Nil; prev = curr, curr = parent_[curr]) {
+            splay(curr);
+            assert(prev == Nil || parent_[prev] == curr);
+            child_[0][curr] = prev;
+        }
+        splay(x);
+        return prev;
+    }
+
+    /// Find root of @p x in *rep* tree.
+    Node root(Node x) {
+        expose(x);
+        auto curr = x;
+        while (right(curr) != Nil) curr = right(curr);
+        splay(curr);
+        return curr;
+    }
+
+    /// Least Common Ancestor of @p a and @p b in the *rep* tree; see LinkCutTree::lca.
+    /// @returns LinkCutForest::Nil, if @p a and @p b are in different trees.
+    Node lca(Node a, Node b) {
+        if (a == b) return a;
+        expose(a);
+        auto w = expose(b);
+        return parent_[a] != Nil ? w : Nil;
+    }
+
+private:
+    bool is_splay_child(Node x) const {
+        auto p = parent_[x];
+        return p != Nil && (child_[0][p] == x || child_[1][p] == x);
+    }
+
+    /// See LinkCutTree::rot.
+    template<size_t l>
+    void rot(Node x) {
+        constexpr size_t r = (l + 1) % 2;
+
+        auto p = parent_[x];
+        auto c = child_[r][x];
+        auto b = child_[l][c];
+
+        if (b != Nil) parent_[b] = x;
+
+        if (p != Nil) {
+            if (child_[l][p] == x) {
+                child_[l][p] = c;
+            } else if (child_[r][p] == x) {
+                child_[r][p] = c;
+            } else {
+                /* only path parent */;
+            }
+        }
+
+        parent_[x]   = c;
+        child_[r][x] = b;
+        parent_[c]   = p;
+        child_[l][c] = x;
+    }
+
+    /// See LinkCutTree::splay.
+    void splay(Node x) {
+        while (is_splay_child(x)) {
+            auto p = parent_[x];
+            if (is_splay_child(p)) {
+                auto pp = parent_[p];
+                if (left(p) == x && left(pp) == p) {          // zig-zig
+                    rot<1>(pp);
+                    rot<1>(p);
+                } else if (right(p) == x && right(pp) == p) { // zag-zag
+                    rot<0>(pp);
+                    rot<0>(p);
+                } else if (left(p) == x && right(pp) == p) {  // zig-zag
+                    rot<1>(p);
+                    rot<0>(pp);
+                } else {                                      // zag-zig
+                    assert(right(p) == x && left(pp) == p);
+                    rot<0>(p);
+                    rot<1>(pp);
+                }
+            } else if (left(p) == x) {                        // zig
+                rot<1>(p);
+            } else {                                          // zag
+                assert(right(p) == x);
+                rot<0>(p);
+            }
+        }
+    }
+
+    std::vector<Node> parent_;                 ///< parent or path-parent
+    std::array<std::vector<Node>, 2> child_;   ///< left/deeper/leaf-direction and right/shallower/root-direction
+};
+
+/// LinkCutTree's CRTP interface for the structural operations - without path aggregates and LinkCutTree::evert -
+/// on top of a LinkCutForest that the *owner* of the @p T%s keeps instead of pointers in @p T itself.
+/// IndexedLinkCutTree has no members; @p T provides
+/// * `LinkCutForest::Node T::node() const`: the dense id that @p T already has - e.g., a gid - as handle into the forest,
+/// * `LinkCutForest& T::forest() const`: the LinkCutForest of its owner, which has a node for each handle, and
+/// * `T* T::at(LinkCutForest::Node) const`: the @p T with the given handle.
+/// ```
+/// class MyClass : public IndexedLinkCutTree<MyClass> { /*...*/ };
+/// ```
+/// @note Expr sticks to LinkCutTree: it needs path and subtree aggregates, LinkCutTree::evert, and the write hook.
+template<class T>
+class IndexedLinkCutTree {
+public:
+    using Node = LinkCutForest::Node;
+
+    /// @name Getters
+    ///@{
+    T* splay_parent() const { return get(links().splay_parent(handle())); }
+    T* path_parent() const { return get(links().path_parent(handle())); }
+    T* left() const { return get(links().left(handle())); }
+    T* right() const { return get(links().right(handle())); }
+    ///@}
+
+    /// @name LinkCutTree Interface
+    /// Both nodes must belong to the same LinkCutForest.
+    ///@{
+    void link(const T* child) const {
+        assert(&links() == &child->forest());
+        links().link(handle(), child->node());
+    }
+    void cut() const { links().cut(handle()); }
+    T* expose() const { return get(links().expose(handle())); }
+    T* root() const { return get(links().root(handle())); }
+    T* lca(const T* other) const {
+        assert(&links() == &other->forest());
+        return get(links().lca(handle(), other->node()));
+    }
+    ///@}
+
+private:
+    const T* self() const { return static_cast<const T*>(this); }
+    Node handle() const { return self()->node(); }
+    LinkCutForest& links() const { return self()->forest(); }
+    T* get(Node node) const { return node == LinkCutForest::Nil ? nullptr : self()->at(node); }
+};
@@ -1,6 +1,118 @@
 #pragma once
 
+#include <cassert>
+#include <cstdint>
+
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <optional>
+#include <span>
 #include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "stats.h"
+
+/// Monoids for the *path aggregates* of a LinkCutTree.
+/// A monoid `M` provides
+/// * `M::Value`: the value of a single node,
+/// * `M::Agg`: the aggregate of a path segment,
+/// * `M::Lazy`: a pending update for all nodes of a path segment; a value-initialized `M::Lazy` must mean "no update",
+/// * `static M::Agg M::lift(const M::Value&)`: the aggregate of a single node,
+/// * `static M::Agg M::combine(const M::Agg& deeper, const M::Agg& shallower)`: must be associative,
+/// * `static void M::apply(const M::Lazy&, M::Value&)` and `static void M::apply(const M::Lazy&, M::Agg&)`,
+/// * `static void M::compose(const M::Lazy& f, M::Lazy& g)`: `g` becomes "first `g`, then `f`".
+///
+/// If `M::combine` is not commutative, `M` must also provide `static void M::reverse(M::Agg&)`
+/// that turns the aggregate of a path into the aggregate of the same path walked the other way around;
+/// LinkCutTree::evert and LinkCutTree::path_aggregate between two nodes rely on it.
+///
+/// If `M::combine` is commutative, invertible, and has a value-initialized `M::Agg` as identity,
+/// `M` may provide `static M::Agg M::subtract(const M::Agg& a, const M::Agg& b)` with `combine(subtract(a, b), b) == a`.
+/// Then, LinkCutTree also maintains *subtree aggregates*; see LinkCutTree::subtree_aggregate.
+namespace agg {
+
+/// No aggregates at all: costs neither space nor time.
+struct None {
+    struct Value {};
+    struct Agg {};
+    struct Lazy {};
+};
+
+/// Number of nodes on a path.
+struct Count {
+    struct Value {
+        bool operator==(const Value&) const = default;
+    };
+    using Agg  = uint32_t;
+    using Lazy = Value;
+
+    static Agg lift(const Value&) { return 1; }
+    static Agg combine(Agg a, Agg b) { return a + b; }
+    static void apply(const Lazy&, Value&) {}
+    static void apply(const Lazy&, Agg&) {}
+    static void compose(const Lazy&, Lazy&) {}
+};
+
+/// Sum of @p V along a path, accumulated in @p A; a path update adds a delta to each node.
+template<class V, class A = V>
+struct Sum {
+    using Value = V;
+    using Lazy  = V;
+    struct Agg {
+        A sum         = 0;
+        uint32_t size = 0; ///< Number of nodes.
+    };
+
+    static Agg lift(const V& v) { return {A(v), 1}; }
+    static Agg combine(const Agg& a, const Agg& b) { return {a.sum + b.sum, a.size + b.size}; }
+    static void apply(const Lazy& d, V& v) { v += d; }
+    static void apply(const Lazy& d, Agg& a) { a.sum += A(d) * A(a.size); }
+    static void compose(const Lazy& f, Lazy& g) { g += f; }
+};
+
+/// agg::Sum that also maintains subtree aggregates: the sum of @p V and the number of nodes below a node.
+template<class V, class A = V>
+struct SubtreeSum : Sum<V, A> {
+    using typename Sum<V, A>::Agg;
+
+    static Agg subtract(const Agg& a, const Agg& b) { return {a.sum - b.sum, a.size - b.size}; }
+};
+
+/// Minimum of @p V along a path; a path update adds a delta to each node.
+template<class V>
+struct Min {
+    using Value = V;
+    using Agg   = V;
+    using Lazy  = V;
+
+    static Agg lift(const V& v) { return v; }
+    static Agg combine(const Agg& a, const Agg& b) { return std::min(a, b); }
+    static void apply(const Lazy& d, V& v) { v += d; }
+    static void compose(const Lazy& f, Lazy& g) { g += f; }
+};
+
+/// Maximum of @p V along a path; a path update adds a delta to each node.
+template<class V>
+struct Max {
+    using Value = V;
+    using Agg   = V;
+    using Lazy  = V;
+
+    static Agg lift(const V& v) { return v; }
+    static Agg combine(const Agg& a, const Agg& b) { return std::max(a, b); }
+    static void apply(const Lazy& d, V& v) { v += d; }
+    static void compose(const Lazy& f, Lazy& g) { g += f; }
+};
+
+} // namespace agg
+
+/// How LinkCutTree::splay restructures an *aux* tree.
+enum class Splaying {
+    BottomUp, ///< Classic zig/zig-zig/zig-zag rotations from the node up to the root of its *aux* tree.
+    TopDown,  ///< [Simple top-down splaying](https://doi.org/10.1145/3828.3835): one restructuring pass down the path.
+};
 
 /// [Link/Cut Tree](https://en.wikipedia.org/wiki/Link/cut_tree) that uses
 /// [CRTP](https://en.wikipedia.org/wiki/Curiously_recurring_template_pattern) to make it intrusive.
@@ -26,19 +138,51 @@
 /// @warning As this is an *intrusive* data structure, it's the responsibility of the user to link/cut nodes in the *rep* tree.
 /// This class **only** manages the *aux* tree.
 /// @note This data structure actually maintains a forest of *rep* and *aux* trees.
+///
+/// The optional monoid @p M (see namespace agg) maintains *path aggregates*:
+/// each node carries an `M::Value` and every *aux* node caches the `M::Agg` of its splay subtree,
+/// so LinkCutTree::path_aggregate and LinkCutTree::path_apply cost O(log n) amortized.
+/// Updates are pushed down lazily during LinkCutTree::splay.
+/// With the default agg::None, the extra members occupy no space and all bookkeeping compiles away.
+///
+/// If @p M supports them, LinkCutTree also maintains *subtree aggregates* (see agg):
+/// each node additionally keeps the `M::Agg` of its *virtual* children - the *aux* trees whose path parent it is -
+/// and every *aux* node caches the `M::Agg` of all *rep* nodes in its splay subtree and below.
+/// LinkCutTree::expose moves the aggregate of a child between these two as the preferred child changes,
+/// so LinkCutTree::subtree_aggregate costs O(log n) amortized and stays valid across LinkCutTree::link and LinkCutTree::cut.
+///
+/// If `S` provides `void S::on_write() const`, LinkCutTree calls it on a node right before it changes any of the members below;
+/// e.g., to journal the old state. Otherwise, this costs nothing.
+///
+/// @p Sp selects the splay variant; see Splaying.
 /// @sa [Splay Tree](https://hackmd.io/@CharlieChuang/By-UlEPFS#Splay-Tree-Sleator-Tarjan-1983)
 /// @sa [Link/Cut Tree](https://hackmd.io/@CharlieChuang/By-UlEPFS#LinkCut-Tree)
-template<class T>
+template<class T, class M = agg::None, Splaying Sp = Splaying::BottomUp>
 class LinkCutTree {
 public:
-    using This                     = LinkCutTree<T>;
+    using This                     = LinkCutTree<T, M, Sp>;
     using S                        = std::remove_const_t<T>;
+    using Value                    = typename M::Value;
+    using Agg                      = typename M::Agg;
+    using Lazy                     = typename M::Lazy;
     static constexpr bool is_const = std::is_const_v<T>;
+    static constexpr bool has_agg  = !std::is_same_v<M, agg::None>;
+    static constexpr bool has_sub  = requires(const Agg& a) { M::subtract(a, a); };
+
+    /// Bytes from the start of a node up to the end of its path aggregate:
+    /// the pointers, flags, value, pending update, and path aggregate that LinkCutTree::splay touches on every node.
+    /// The subtree aggregates come after these.
+    static constexpr size_t hot_size() { return offsetof(This, agg_) + sizeof(Agg); }
+
+    LinkCutTree() {
+        if constexpr (has_agg) agg_ = M::lift(val_);
+        if constexpr (has_sub) tot_ = agg_;
+    }
 
     /// @name Getters
     ///@{
-    const S* splay_parent() const { return parent_ && (parent_->left_ == this || parent_->right_ == this) ? parent_ : nullptr; }
-    const S* path_parent() const { return parent_ && (parent_->left_ != this && parent_->right_ != this) ? parent_ : nullptr; }
+    const S* splay_parent() const { return root_ ? nullptr : parent_; }
+    const S* path_parent() const { return root_ ? parent_ : nullptr; }
     const S* left() const { return left_; }
     const S* right() const { return right_; }
     const S*& child(size_t i) const { return i == 0 ? left_ : right_; }
@@ -50,10 +194,24 @@ public:
         self()->expose();
         child->expose();
         if (!child->right_) {
-            self()->parent_ = child;
-            child->right_   = self();
+            set_child(child, 1, self());
+            child->aggregate();
+        }
+    }
+
+    /// O(1) variant of LinkCutTree::link for bulk construction:
+    /// @p child must be the root of both its *rep* and its *aux* tree - e.g., a fresh node - so `this` simply becomes its path parent.
+    /// With subtree aggregates, `this` is exposed first to account for its new virtual child, which costs O(log n) amortized.
+    void attach(const S* child) const {
+        assert(child->root_ && !child->parent_ && !child->right_ && "child must be a fresh rep and aux root");
+        if constexpr (has_sub) {
+            expose();
+            touch(self());
+            vir_ = M::combine(vir_, child->tot_);
+            tot_ = M::combine(tot_, child->tot_);
         }
-        self()->aggregate();
+        touch(child);
+        child->parent_ = self();
     }
 
     /// Deregisters the edge `this -> parent` in the *aux* tree.
@@ -61,9 +219,12 @@ public:
     void cut() const {
         expose();
         if (right_) {
-            right_->aggregate();
+            touch(self());
+            touch(right_);
             right_->parent_ = nullptr;
+            right_->root_   = true;
             right_          = nullptr;
+            aggregate();
         }
     }
 
@@ -71,13 +232,28 @@ public:
     /// @returns the last valid LinkCutTree::path_parent.
     const S* expose() const {
         const S* prev = nullptr;
-        for (auto curr = self(); curr; prev = curr, curr = curr->parent_) {
+        [[maybe_unused]] uint64_t hops = 0;
+        for (auto curr = self(); curr; prev = curr, curr = curr->parent_, ++hops) {
             curr->splay();
             assert(!prev || prev->parent_ == curr);
-            curr->left_ = prev;
+            touch(curr);
+            if (auto l = curr->left_) {
+                touch(l);
+                l->root_ = true; // keeps curr as path parent
+                if constexpr (has_sub) curr->vir_ = M::combine(curr->vir_, l->tot_);
+            }
+            if constexpr (has_sub) {
+                if (prev) curr->vir_ = M::subtract(curr->vir_, prev->tot_);
+            }
+            set_child(curr, 0, prev);
             curr->aggregate();
         }
         splay();
+        if constexpr (stats::enabled) {
+            auto& c = stats::counters();
+            ++c.num_exposes;
+            stats::sample(c.num_hops, c.max_hops, hops - 1);
+        }
         return prev;
     }
 
@@ -85,24 +261,137 @@ public:
     const S* root() const {
         expose();
         auto curr = self();
-        while (auto r = curr->right_) curr = r;
+        [[maybe_unused]] uint64_t walk = 0;
+        while (auto r = curr->right_) {
+            r->push();
+            curr = r;
+            ++walk;
+        }
+        if constexpr (stats::enabled) {
+            auto& c = stats::counters();
+            ++c.num_root_walks;
+            stats::sample(c.root_walk, c.max_root_walk, walk);
+        }
+        curr->splay();
+        return curr;
+    }
+
+    /// Parent of `this` in the *rep* tree or `nullptr` if `this` is a root.
+    /// After exposing `this`, the parent is the deepest node of the path above, i.e. the leftmost node of LinkCutTree::right.
+    const S* parent() const {
+        expose();
+        auto curr = right_;
+        if (!curr) return nullptr;
+        curr->push();
+        while (auto l = curr->left_) {
+            l->push();
+            curr = l;
+        }
         curr->splay();
         return curr;
     }
 
+    /// Makes `this` the root of its *rep* tree (a.k.a. `make_root`); the tree stays the same as an undirected tree.
+    /// Exposes `this` and reverses the resulting path lazily, so this costs O(log n) amortized.
+    /// For example, `v->evert(); u->link(v);` connects two arbitrary nodes of different trees.
+    /// @warning This changes parent/child relations in the *rep* tree. Rooted queries like LinkCutTree::root,
+    /// LinkCutTree::lca, or LinkCutTree::path_aggregate are answered w.r.t. the new root afterwards.
+    void evert() const {
+        expose();
+        reverse(self());
+    }
+
+    /// Are `this` and @p other in the same *rep* tree?
+    bool connected(const S* other) const { return lca(other) != nullptr; }
+
     /// Least Common Ancestor of `this` and @p other in the *rep* tree.
-    /// @returns `nullptr`, if @p a and @p b are in different trees.
+    /// Exposing `this` leaves it without parent; exposing @p other afterwards hooks `this` below some node -
+    /// unless they live in different trees. Hence, two exposes suffice and no LinkCutTree::root walk is needed.
+    /// @returns `nullptr`, if `this` and @p other are in different trees.
     const S* lca(const S* other) const {
         if (self() == other) return other;
-        if (self()->root() != other->root()) return nullptr;
-        self()->expose();
-        return other->expose();
+        expose();
+        auto w = other->expose();
+        return parent_ ? w : nullptr;
+    }
+
+    /// Batch version of LinkCutTree::lca: the result at index `i` is the lca of `queries[i].first` and `queries[i].second`.
+    /// The queries are processed grouped by their first node:
+    /// after a query, the path of its first node is still preferred - except for the part below the lca -
+    /// so exposing the same node again for the next query only takes a single path-parent hop.
+    static std::vector<const S*> lca_many(std::span<const std::pair<const S*, const S*>> queries) {
+        std::vector<size_t> order(queries.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::ranges::stable_sort(order, std::less<const S*>(), [&](size_t i) { return queries[i].first; });
+
+        std::vector<const S*> res(queries.size());
+        for (auto i : order) res[i] = queries[i].first->lca(queries[i].second);
+        return res;
+    }
+
+    /// @name Path Aggregates
+    /// Only available with a monoid @p M other than agg::None.
+    ///@{
+    Value value() const requires has_agg {
+        splay();
+        return val_;
+    }
+    /// With subtree aggregates, this exposes `this`, as all nodes above depend on its value.
+    void set_value(const Value& v) const requires has_agg {
+        if constexpr (has_sub)
+            expose();
+        else
+            splay();
+        touch(self());
+        val_ = v;
+        aggregate();
+    }
+    /// Aggregate of all nodes on the path from `this` to its root in the *rep* tree (both inclusive).
+    Agg path_aggregate() const requires has_agg {
+        expose();
+        return agg_;
+    }
+    /// Applies @p f to all nodes on the path from `this` to its root in the *rep* tree (both inclusive).
+    void path_apply(const Lazy& f) const requires has_agg {
+        expose();
+        apply(self(), f);
     }
+    /// Aggregate of all nodes on the path from `this` via their LinkCutTree::lca to @p other (both inclusive).
+    /// Unlike LinkCutTree::evert, this does not alter the *rep* tree.
+    /// @returns `std::nullopt`, if `this` and @p other are in different trees.
+    std::optional<Agg> path_aggregate(const S* other) const requires has_agg {
+        if (self() == other) return M::lift(value());
+        expose();
+        auto w = other->expose();
+        if (!parent_) return std::nullopt;
+
+        // w's aux tree holds the path from other to the root; its left subtree runs from other up to - but excluding - w
+        w->splay();
+        auto res = M::lift(w->val_);
+        if (auto l = w->left_) {
+            auto a = l->agg_;
+            if constexpr (requires { M::reverse(a); }) M::reverse(a);
+            res = M::combine(res, a);
+        }
+        // expose(other) has cut off the path from `this` up to - but excluding - w into its own aux tree
+        if (w != self()) {
+            splay();
+            res = M::combine(agg_, res);
+        }
+        return res;
+    }
+    ///@}
 
-    /// Aggregate dummy implementations; "override" in @p S (no `virtual` override required due to CRTP).
-    void aggregate() const {}
-    //void aggregate_sub(const S*) const {}
-    //void aggregate_add(const S*) const {}
+    /// @name Subtree Aggregates
+    /// Only available with a monoid @p M that supports them; see agg.
+    ///@{
+    /// Aggregate of `this` and all its descendants in the *rep* tree.
+    /// After exposing `this`, all of them hang below `this` as virtual children.
+    Agg subtree_aggregate() const requires has_sub {
+        expose();
+        return M::combine(M::lift(val_), vir_);
+    }
+    ///@}
 
     // clang-format off
     /// @name Non-Const Variants
@@ -113,6 +402,7 @@ public:
     S* right()          requires (!is_const) { return const_cast<S*>(const_cast<const This*>(this)->right()); }
     S*& child(size_t i) requires (!is_const) { return const_cast<S*>(const_cast<const This*>(this)->child(i)); }
     S* root()           requires (!is_const) { return const_cast<S*>(const_cast<const This*>(this)->root()); }
+    S* parent()         requires (!is_const) { return const_cast<S*>(const_cast<const This*>(this)->parent()); }
     S* expose()         requires (!is_const) { return const_cast<S*>(const_cast<const This*>(this)->expose()); }
     void link(S* up)    requires (!is_const) { return const_cast<const This*>(this)->link(const_cast<const S*>(up)); }
     S* lca(S* other)    requires (!is_const) { return const_cast<S*>(const_cast<const This*>(this)->lca(const_cast<const S*>(other))); }
@@ -146,61 +436,216 @@ protected:
         auto x = self();
         auto p = x->parent_;
         auto c = x->child(r);
-        //auto b = c ? c->child(l) : nullptr;
         auto b = c->child(l);
 
-        if (b) b->parent_ = x;
-
-        if (p) {
-            if (p->child(l) == x) {
-                p->child(l) = c;
-            } else if (p->child(r) == x) {
-                p->child(r) = c;
-            } else {
-                /* only path parent */;
-            }
+        if (x->root_) { // only path parent
+            touch(c);
+            c->parent_ = p;
+            c->root_   = true;
+        } else {
+            set_child(p, x->dir_, c);
         }
+        set_child(x, r, b);
+        set_child(c, l, x);
 
-        x->parent_  = c;
-        x->child(r) = b;
-
-        //if (c) {
-            c->parent_  = p;
-            c->child(l) = x;
-        //}
-
-        //x->aggregate();
-        //c->aggregate();
+        x->aggregate();
+        c->aggregate();
+        if constexpr (stats::enabled) ++stats::counters().num_rotations;
     }
 
     /// [Splays](https://hackmd.io/@CharlieChuang/By-UlEPFS#Operation1) `this` to the root of its splay tree.
+    /// Pending updates of all nodes involved are pushed down before rotating them.
+    /// Rotations keep each node within the subtrees of its other ancestors, so their updates may stay pending.
     void splay() const {
-        while (auto p = splay_parent()) {
-            if (auto pp = p->splay_parent()) {
-                if (p->left_ == this && pp->left_ == p) {           // zig-zig
+        if constexpr (Sp == Splaying::TopDown) return splay_top_down();
+
+        [[maybe_unused]] uint64_t depth = 0;
+        while (!root_) {
+            auto p  = parent_;
+            auto pp = p->splay_parent();
+            if (pp) pp->push();
+            p->push();
+            push();
+
+            if (pp) {
+                depth += 2;
+                if (dir_ == 0 && p->dir_ == 0) {        // zig-zig
                     pp->ror();
                     p->ror();
-                } else if (p->right_ == this && pp->right_ == p) {  // zag-zag
+                } else if (dir_ == 1 && p->dir_ == 1) { // zag-zag
                     pp->rol();
                     p->rol();
-                } else if (p->left_ == this && pp->right_ == p) {   // zig-zag
+                } else if (dir_ == 0) {                 // zig-zag
                     p->ror();
                     pp->rol();
-                } else {                                            // zag-zig
-                    assert(p->right_ == this && pp->left_ == p);
+                } else {                                // zag-zig
                     p->rol();
                     pp->ror();
                 }
-            } else if (p->left_ == this) {                          // zig
+            } else if (dir_ == 0) {                     // zig
+                ++depth;
                 p->ror();
-            } else {                                                // zag
-                assert(p->right_ == this);
+            } else {                                    // zag
+                ++depth;
                 p->rol();
             }
         }
+        push();
+        count_splay(depth);
+    }
+
+    /// Splaying::TopDown variant of LinkCutTree::splay.
+    /// Records the path from the root of the *aux* tree down to `this` and pushes all pending updates along it.
+    /// Then, it walks down this path once and hangs the nodes into a left tree `L` and a right tree `R`
+    /// that finally become the children of `this`; only the spines of `L` and `R` need new aggregates.
+    void splay_top_down() const {
+        auto& path = path_buffer();
+        path.clear();
+        for (auto x = self();; x = x->parent_) {
+            path.emplace_back(x);
+            if (x->root_) break;
+        }
+        for (auto i = path.size(); i-- != 0;) path[i]->push();
+        count_splay(path.size() - 1);
+        if (path.size() == 1) return;
+
+        auto x      = self();
+        auto pp     = path.back()->parent_;
+        const S* l  = nullptr; // root of L
+        const S* r  = nullptr; // root of R
+        const S* lt = nullptr; // last node hung into L; its right child is still to be set
+        const S* rt = nullptr; // last node hung into R; its left child is still to be set
+        auto to_l   = [&](const S* n) { lt ? set_child(lt, 1, n) : void(l = n), lt = n; };
+        auto to_r   = [&](const S* n) { rt ? set_child(rt, 0, n) : void(r = n), rt = n; };
+
+        for (size_t i = path.size() - 1; i != 0;) {
+            auto t = path[i];
+            auto c = path[i - 1];
+            bool d = c->dir_;
+            if (i >= 2 && path[i - 2]->dir_ == d) { // zig-zig/zag-zag: rotate c above t first
+                set_child(t, d, c->child(!d));
+                set_child(c, !d, t);
+                t->aggregate();
+                if constexpr (stats::enabled) ++stats::counters().num_rotations;
+                d ? to_l(c) : to_r(c);
+                i -= 2;
+            } else {                                // zig/zag or first half of zig-zag/zag-zig
+                d ? to_l(t) : to_r(t);
+                i -= 1;
+            }
+        }
+
+        lt ? set_child(lt, 1, x->left_) : void(l = x->left_);
+        rt ? set_child(rt, 0, x->right_) : void(r = x->right_);
+        if constexpr (has_agg) {
+            for (auto n = lt; n; n = n == l ? nullptr : n->parent_) n->aggregate();
+            for (auto n = rt; n; n = n == r ? nullptr : n->parent_) n->aggregate();
+        }
+        set_child(x, 0, l);
+        set_child(x, 1, r);
+        touch(x);
+        x->parent_ = pp;
+        x->root_   = true;
+        x->aggregate();
+    }
+
+    static void count_splay([[maybe_unused]] uint64_t depth) {
+        if constexpr (stats::enabled) {
+            auto& c = stats::counters();
+            ++c.num_splays;
+            stats::sample(c.splay_depth, c.max_splay_depth, depth);
+        }
+    }
+
+    static std::vector<const S*>& path_buffer() {
+        thread_local std::vector<const S*> path;
+        return path;
+    }
+
+    /// Invokes the write hook `S::on_write`, if any, on @p x.
+    static void touch(const S* x) {
+        if constexpr (requires { x->on_write(); }) x->on_write();
+    }
+
+    /// Makes @p c the child @p d of @p p and keeps the cached bits of @p c in sync; @p c may be `nullptr`.
+    static void set_child(const S* p, size_t d, const S* c) {
+        touch(p);
+        p->child(d) = c;
+        if (c) {
+            touch(c);
+            c->parent_ = p;
+            c->root_   = false;
+            c->dir_    = d;
+        }
+    }
+
+    /// Recomputes LinkCutTree::agg_ - and LinkCutTree::tot_ - from the children.
+    void aggregate() const {
+        if constexpr (has_agg) {
+            touch(self());
+            agg_ = M::lift(val_);
+            if (left_) agg_ = M::combine(left_->agg_, agg_);
+            if (right_) agg_ = M::combine(agg_, right_->agg_);
+        }
+        if constexpr (has_sub) {
+            tot_ = M::combine(M::lift(val_), vir_);
+            if (left_) tot_ = M::combine(left_->tot_, tot_);
+            if (right_) tot_ = M::combine(tot_, right_->tot_);
+        }
+    }
+
+    /// Reverses the path stored in the splay subtree of @p x - lazily for its descendants.
+    static void reverse(const S* x) {
+        touch(x);
+        std::swap(x->left_, x->right_);
+        if (x->left_) touch(x->left_), x->left_->dir_ = 0;
+        if (x->right_) touch(x->right_), x->right_->dir_ = 1;
+        x->rev_ = !x->rev_;
+        if constexpr (has_agg) {
+            if constexpr (requires { M::reverse(x->agg_); }) M::reverse(x->agg_);
+        }
+    }
+
+    /// Applies @p f to the whole splay subtree of @p x.
+    /// @p f only affects the nodes on the path; so LinkCutTree::tot_ swaps their old aggregate for the new one.
+    static void apply(const S* x, const Lazy& f) {
+        touch(x);
+        M::apply(f, x->val_);
+        if constexpr (has_sub) x->tot_ = M::subtract(x->tot_, x->agg_);
+        M::apply(f, x->agg_);
+        if constexpr (has_sub) x->tot_ = M::combine(x->tot_, x->agg_);
+        M::compose(f, x->lazy_);
+    }
+
+    /// Hands the pending reversal and update of `this` over to its children.
+    void push() const {
+        if (rev_) {
+            touch(self());
+            if (left_) reverse(left_);
+            if (right_) reverse(right_);
+            rev_ = false;
+        }
+        if constexpr (has_agg) {
+            if (lazy_ == Lazy()) return;
+            touch(self());
+            if (left_) apply(left_, lazy_);
+            if (right_) apply(right_, lazy_);
+            lazy_ = Lazy();
+        }
     }
 
     mutable const S* parent_ = nullptr; ///< parent or path-parent
     mutable const S* left_   = nullptr; ///< left/deeper/down/leaf-direction
     mutable const S* right_  = nullptr; ///< right/shallower/up/root-direction
+    mutable bool rev_ : 1    = false;   ///< reversal pending for the children; already applied to `this`
+    mutable bool root_ : 1   = true;    ///< cached: Is `this` the root of its *aux* tree, i.e. is parent_ a path parent?
+    mutable bool dir_ : 1    = false;   ///< cached: Is `this` the left (`0`) or right (`1`) child of its splay parent?
+    [[no_unique_address]] mutable Value val_ = {}; ///< value of this node
+    [[no_unique_address]] mutable Lazy lazy_ = {}; ///< update pending for the children; already applied to `this`
+    [[no_unique_address]] mutable Agg agg_   = {}; ///< aggregate of the splay subtree rooted at `this`
+    // distinct empty types, so both occupy no space without subtree aggregates
+    template<size_t> struct NoSub {};
+    template<size_t I> using SubAgg = std::conditional_t<has_sub, Agg, NoSub<I>>;
+    [[no_unique_address]] mutable SubAgg<0> vir_ = {}; ///< aggregate of all virtual children and their descendants
+    [[no_unique_address]] mutable SubAgg<1> tot_ = {}; ///< aggregate of the splay subtree rooted at `this` and everything below
 };
@@ -1,12 +1,82 @@
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <thread>
 
+#include "dom.h"
+#include "dot.h"
+#include "gcm.h"
 #include "world.h"
+#include "link_cut_forest.h"
 #include "link_cut_tree.h"
+#include "tape.h"
 
-struct Test : public LinkCutTree<Test> {
+/// Uses either LinkCutTree or IndexedLinkCutTree as backend.
+template<template<class> class LCT>
+struct Test : public LCT<Test<LCT>> {
     int i = 0;
 };
 
+/// With IndexedLinkCutTree, an Owner hands out the dense ids, keeps the LinkCutForest, and maps ids back to Test%s.
+template<>
+struct Test<IndexedLinkCutTree> : public IndexedLinkCutTree<Test<IndexedLinkCutTree>> {
+    struct Owner {
+        LinkCutForest forest;
+        std::vector<Test*> tests;
+    };
+
+    Test(Owner& owner)
+        : owner_(owner)
+        , node_(Node(owner.tests.size())) {
+        owner.tests.emplace_back(this);
+        owner.forest.resize(owner.tests.size());
+    }
+    Test(const Test&)            = delete;
+    Test& operator=(const Test&) = delete;
+
+    Node node() const { return node_; }
+    LinkCutForest& forest() const { return owner_.forest; }
+    Test* at(Node node) const { return owner_.tests[node]; }
+
+    int i = 0;
+
+private:
+    Owner& owner_;
+    Node node_;
+};
+
+/// @p args go to the constructor of each Test, e.g., the Test<IndexedLinkCutTree>::Owner.
+template<template<class> class LCT, class... Args>
+void test_lct(Args&... args) {
+    Test<LCT> a(args...), b(args...);
+    b.link(&a);
+    auto r = a.root();
+    r->i++;
+    if (auto p = a.splay_parent()) p->i++;
+    assert(r == &b);
+
+    // rep tree: 0 -> {1, 2}, 1 -> {3, 4}, 2 -> {5}
+    std::deque<Test<LCT>> n;
+    for (size_t i = 0; i != 6; ++i) n.emplace_back(args...);
+    n[0].link(&n[1]);
+    n[0].link(&n[2]);
+    n[1].link(&n[3]);
+    n[1].link(&n[4]);
+    n[2].link(&n[5]);
+    assert(n[3].lca(&n[4]) == &n[1]);
+    assert(n[3].lca(&n[5]) == &n[0]);
+    assert(n[5].root() == &n[0]);
+    n[2].cut();
+    assert(n[5].root() == &n[2]);
+    assert(n[3].lca(&n[5]) == nullptr);
+}
+
 template<bool flip>
 void test_splay() {
     World w;
@@ -43,11 +113,12 @@ int main() {
     test_splay<false>();
     test_splay<true>();
 
-    Test a, b;
-    b.link(&a);
-    auto r = a.root();
-    r->i++;
-    if (auto p = a.splay_parent()) p->i++;
+    test_lct<LinkCutTree>();
+    for (size_t i = 0; i != 2; ++i) { // each run registers its nodes with a fresh Owner
+        Test<IndexedLinkCutTree>::Owner owner;
+        test_lct<IndexedLinkCutTree>(owner);
+        assert(owner.forest.size() == 8);
+    }
 
     {
         World w;
@@ -65,7 +136,7 @@ int main() {
         auto a = w.id('a');
         auto b = w.id('b');
         auto eq = w.eq(w.lit(0), w.lit(1));
-        auto ab = w.add(a, b);
+        [[maybe_unused]] auto ab = w.add(a, b);
         auto sel = w.select(eq, ab, w.add(w.lit(2), w.lit(3)));
         sel->dot();
         w.lit(1)->expose();
@@ -96,10 +167,136 @@ int main() {
 
         w.lit(1)->cut();
         auto z = w.id('z');
-        const_cast<Expr*>(ab)->ops[1] = z;
-        ab->link(z);
+        w.replace_all_uses_with(b, z);
+        assert(w.add(a, z) == ab && z->parent() == ab);
         sel->dot();
     }
+    {   // path aggregates: rep paths a -> ab -> sel and b -> ab -> sel
+        World w;
+        auto a   = w.id('a');
+        auto b   = w.id('b');
+        auto ab  = w.add(a, b);
+        auto sel = w.select(w.lit(0), ab, b);
+        a->set_value(1);
+        ab->set_value(2);
+        sel->set_value(4);
+        assert(a->path_aggregate().sum == 7 && a->path_aggregate().size == 3);
+
+        a->path_apply(10);
+        assert(sel->value() == 14 && b->value() == 0);
+        assert(ab->path_aggregate().sum == 26 && ab->path_aggregate().size == 2);
+        assert(b->path_aggregate().sum == 26 && b->path_aggregate().size == 3);
+
+        ab->cut();
+        assert(a->path_aggregate().sum == 23 && a->path_aggregate().size == 2);
+        assert(sel->path_aggregate().sum == 14 && sel->path_aggregate().size == 1);
+
+        // paths between arbitrary nodes: b -> ab -> a
+        assert(b->connected(a) && !a->connected(sel));
+        assert(b->path_aggregate(a)->sum == 23 && b->path_aggregate(a)->size == 3);
+        assert(!sel->path_aggregate(b));
+        a->evert();
+        assert(ab->root() == a && b->root() == a);
+        assert(b->path_aggregate().sum == 23 && b->path_aggregate(a)->size == 3);
+    }
+    {   // subtree aggregates: rep tree sel -> {0, ab -> {a, b}}; a value of 1 marks the free variables
+        World w;
+        auto a   = w.id('a');
+        auto b   = w.id('b');
+        auto ab  = w.add(a, b);
+        auto sel = w.select(w.lit(0), ab, b);
+        a->set_value(1);
+        b->set_value(1);
+        assert(sel->subtree_aggregate().sum == 2 && sel->subtree_aggregate().size == 5);
+        assert(ab->subtree_aggregate().size == 3 && a->subtree_aggregate().size == 1);
+
+        a->path_apply(10);
+        assert(sel->subtree_aggregate().sum == 32 && ab->subtree_aggregate().sum == 22 && b->subtree_aggregate().sum == 1);
+
+        ab->cut();
+        assert(sel->subtree_aggregate().sum == 10 && sel->subtree_aggregate().size == 2);
+        assert(ab->subtree_aggregate().sum == 22 && ab->subtree_aggregate().size == 3);
+        sel->link(ab);
+        assert(sel->subtree_aggregate().sum == 32 && sel->subtree_aggregate().size == 5);
+        a->evert();
+        assert(a->subtree_aggregate().size == 5 && sel->subtree_aggregate().size == 2 && ab->subtree_aggregate().sum == 21);
+    }
+    {   // speculation: rewrite a + b to a + z, then roll back
+        World w;
+        auto a   = w.id('a');
+        auto b   = w.id('b');
+        auto ab  = w.add(a, b);
+        auto sel = w.select(w.lit(0), ab, b);
+        a->set_value(1);
+        [[maybe_unused]] size_t n = w.gid;
+
+        w.checkpoint();
+        ab->cut();
+        auto z = w.id('z');
+        const_cast<Expr*>(ab)->set_op(1, z);
+        ab->link(z);
+        [[maybe_unused]] auto az = w.mul(ab, z);
+        a->path_apply(10);
+        assert(a->root() == az && z->parent() == ab && a->path_aggregate().sum == 31);
+        w.rollback();
+
+        assert(w.gid == n && w.num_checkpoints() == 0);
+        assert(ab->op(1) == b && ab->parent() == sel && a->root() == sel);
+        assert(a->path_aggregate().sum == 1 && sel->subtree_aggregate().size == 5);
+        assert(w.id('z')->gid == n && w.add(a, b) == ab);
+
+        // nested: the inner rollback only undoes its own changes
+        w.checkpoint();
+        sel->set_value(2);
+        w.checkpoint();
+        a->evert();
+        b->set_value(4);
+        w.rollback();
+        assert(a->root() == sel && b->value() == 0 && a->path_aggregate().sum == 3);
+        w.commit();
+        assert(w.num_checkpoints() == 0 && sel->value() == 2);
+    }
+    {   // use-lists: replace b with a in (a + b) * c and a * c + b * c
+        World w;
+        auto a   = w.id('a');
+        auto b   = w.id('b');
+        auto c   = w.id('c');
+        auto ab  = w.add(a, b);
+        auto abc = w.mul(ab, c);
+        auto ac  = w.mul(a, c);
+        auto bc  = w.mul(b, c);
+        auto sum = w.add(ac, bc);
+        assert(b->num_uses() == 2 && c->num_uses() == 3 && sum->uses().empty());
+
+        [[maybe_unused]] auto bc_mem = static_cast<const void*>(bc);
+        w.replace_all_uses_with(b, a);
+        assert(b->uses().empty() && a->num_uses() == 3 && c->num_uses() == 2);
+        assert(w.add(a, a) == ab && abc->op(0) == ab);
+        // b * c has become a duplicate of a * c and is gone - its memory goes to the next Expr of the same size
+        assert(w.mul(a, c) == ac && w.add(ac, ac) == sum && w.mul(b, b) == bc_mem);
+        for ([[maybe_unused]] auto e : {a, b, c, ab, abc, ac, sum})
+            assert(!e->parent() || std::ranges::find(e->parent()->ops(), e) != e->parent()->ops().end());
+    }
+    {   // bulk construction: a 2 + b * a 0 +
+        World w;
+        auto a = w.id('a');
+        auto b = w.id('b');
+        [[maybe_unused]] auto ab = w.add(a, b);
+        auto prog = std::vector<World::Instr>{
+            {Tag::Id, 'a'}, {Tag::Lit, 2}, {Tag::Add}, {Tag::Id, 'b'}, {Tag::Mul}, {Tag::Id, 'a'}, {Tag::Lit, 0}, {Tag::Add},
+        };
+        auto roots = w.build(prog);
+        [[maybe_unused]] auto a2 = w.add(w.lit(2), a);
+        assert(roots.size() == 2 && roots[0] == w.mul(a2, b) && roots[1] == a);
+        assert(w.lit(2)->parent() == a2 && a2->parent() == roots[0]);
+        assert(a->parent() == ab && b->parent() == ab && b->num_uses() == 2);
+
+        // malformed programs
+        [[maybe_unused]] auto num_gids = size_t(w.gid);
+        auto underflow = std::vector<World::Instr>{{Tag::Id, 'c'}, {Tag::Lit, 1}, {Tag::Add}, {Tag::Mul}};
+        auto bb        = std::vector<World::Instr>{{Tag::Id, 'c'}, {Tag::BB}};
+        assert(w.build(underflow).empty() && w.build(bb).empty() && w.gid == num_gids);
+    }
     {
         World w;
         auto x = w.id('x');
@@ -140,6 +337,30 @@ int main() {
         alt  ->set(w.jmp(next, w.lit(42)));
         next ->set(w.jmp(r, p));
         start->dot();
+
+        DomTree dom(start, true);
+        assert(dom.size() == 4);
+        assert(dom.idom(start) == nullptr && dom.idom(cons) == start && dom.idom(next) == start);
+        assert(dom.lca(cons, alt) == start && dom.dominates(start, next) && !dom.dominates(cons, next));
+        assert(dom.depth(start) == 0 && dom.depth(next) == 1);
+
+        // rewire the CFG in place and let dom follow incrementally
+        auto retarget = [&](Expr* bb, const Expr* body) {
+            bb->op(0)->cut();
+            bb->set_op(0, body);
+            bb->link(body);
+            dom.update(bb);
+        };
+        [[maybe_unused]] auto old = cons->op(0);
+        retarget(cons, w.jmp(alt, w.lit(1)));
+        assert(dom.idom(alt) == start && dom.idom(next) == alt);
+        assert(old->uses().empty() && cons->op(0)->uses().begin()->user() == cons);
+        retarget(start, w.jmp(cons, w.lit(2)));
+        assert(dom.idom(alt) == cons && dom.depth(next) == 3);
+        retarget(cons, w.jmp(next, w.lit(3)));
+        assert(!dom.is_reachable(alt) && dom.idom(next) == cons && dom.size() == 3);
+        retarget(next, w.jmp(alt, p));
+        assert(dom.idom(alt) == next && dom.lca(alt, cons) == cons && dom.verify());
     }
     {   // loop
         World w;
@@ -155,9 +376,282 @@ int main() {
         body ->set(w.jmp(head, w.add(i, w.lit(1))));
         exit ->set(w.jmp(r, i));
         start->dot();
+
+        DomTree dom(start);
+        assert((DomTree::succs(head) == std::vector<const Expr*>{exit, body}));
+        assert(dom.idom(head) == start && dom.idom(body) == head && dom.idom(exit) == head);
+        assert(dom.dominates(head, body) && !dom.dominates(body, head) && dom.depth(exit) == 2);
         body->expose();
         start->dot();
     }
+    {   // random CFG edits in verified mode: edge removals keep, move, and cut off dominator subtrees
+        World w;
+        std::mt19937_64 rng(42);
+        std::vector<Expr*> bbs;
+        for (size_t i = 0; i != 24; ++i) bbs.emplace_back(w.bb());
+        auto x    = w.id('x');
+        auto body = [&](size_t i) -> const Expr* {
+            auto n = bbs.size();
+            if (rng() % 4 == 0) return w.jmp(bbs[rng() % n], w.lit(i));
+            return w.br(w.eq(x, w.lit(i)), bbs[rng() % n], bbs[rng() % n]);
+        };
+        // bodies may jump back to their BB: skip the LinkCutTree of the Expr%s
+        for (size_t i = 0; i != bbs.size(); ++i) bbs[i]->set_op(0, body(i));
+
+        DomTree dom(bbs[0], true);
+        for (size_t k = 0; k != 2000; ++k) {
+            auto i = rng() % bbs.size();
+            bbs[i]->set_op(0, body(i));
+            dom.update(bbs[i]);
+        }
+        assert(dom.verify());
+    }
+    {   // concurrent World: threads that build the same Expr receive the same node
+        auto build = [](World& w) {
+            auto e = w.id('x');
+            for (uint64_t i = 0; i != 1000; ++i) e = w.mul(w.add(e, w.lit(i)), w.id('y'));
+            return e;
+        };
+
+        World ref;
+        World w(16);
+        const Expr* res[4];
+        std::vector<std::thread> threads;
+        for (auto& r : res) threads.emplace_back([&] { r = build(w); });
+        for (auto& t : threads) t.join();
+        w.link();
+
+        build(ref);
+        assert(std::ranges::all_of(res, [&](auto r) { return r == res[0]; }));
+        assert(w.gid == ref.gid && build(w) == res[0]); // no duplicates
+        assert(w.id('x')->root() == res[0]);
+    }
+    {   // deterministic World: the same DAG built by 1 and 4 threads yields the same gids, aux trees, and Dot output
+        auto item = [](World& w, uint64_t i) {
+            auto x = w.id('x');
+            auto y = w.id('y');
+            return w.add(w.mul(w.add(x, w.lit(i % 10)), w.sub(y, w.lit(i % 7))), w.minus(w.lit(i % 3)));
+        };
+        auto build = [&](size_t num_threads) {
+            auto w = std::make_unique<World>(16);
+            std::vector<const Expr*> items(64);
+            std::vector<std::thread> threads;
+            for (size_t t = 0; t != num_threads; ++t)
+                threads.emplace_back([&, t] {
+                    for (size_t i = t; i < items.size(); i += num_threads) items[i] = item(*w, i);
+                });
+            for (auto& t : threads) t.join();
+            w->link();
+
+            auto sum = items.front();
+            for (auto i : items) sum = w->add(sum, i);
+            w->link();
+
+            std::ostringstream os;
+            sum->dot(os);
+            return std::pair(std::move(w), os.str());
+        };
+        auto [w1, dot1] = build(1);
+        auto [w4, dot4] = build(4);
+        assert(w1->gid == w4->gid && dot1 == dot4);
+    }
+    {   // Dot output with limits: chain of 100 u-
+        World w;
+        auto e = w.id('x');
+        for (int i = 0; i != 100; ++i) e = w.minus(e);
+
+        // number of edges + whether the output has been truncated
+        [[maybe_unused]] auto summary = [&](DotWriter&& dot) {
+            std::ostringstream os;
+            dot.write(os, e);
+            auto s = os.str();
+            return std::to_string(std::ranges::count(s, '>')) + (s.find("dotted") != std::string::npos ? " dotted" : "");
+        };
+        assert(summary(DotWriter(DotWriter::View::Rep)) == "100");
+        assert(summary(DotWriter(DotWriter::View::Rep, {.max_depth = 3})) == "3 dotted");
+        assert(summary(DotWriter(DotWriter::View::Rep, {.max_nodes = 10})) == "9 dotted");
+        assert(summary(DotWriter()).find("dotted") == std::string::npos);
+    }
+    {   // textual output: shared Expr%s are bound once, even if the tree behind the DAG is exponential
+        World w;
+        auto x = w.id('x');
+        auto a = w.add(x, w.lit(1));
+        auto e = w.sub(w.mul(a, a), w.minus(a));
+        for (int i = 0; i != 100; ++i) e = w.add(e, e);
+        auto bb = w.bb();
+        bb->set(w.jmp(bb, a));
+
+        [[maybe_unused]] auto str = [](const Expr* e) {
+            std::ostringstream os;
+            e->dump(os);
+            return os.str();
+        };
+        assert(str(w.mul(w.minus(x), w.lit(2))) == "(* (u- x) 2)");
+        assert(str(w.sub(w.mul(a, a), w.minus(a))) == "let _2 = (+ 1 x)\n(- (* _2 _2) (u- _2))");
+        assert(str(e).size() < 100 * 32);
+        assert(str(bb) == "let _106 = (BB (jmp _106 (+ 1 x)))\n_106");
+    }
+    {   // garbage collection: only (x + 1) * y survives the rewrites
+        World w;
+        auto x = w.id('x');
+        auto y = w.id('y');
+        auto e = w.mul(w.add(x, w.lit(1)), y);
+        for (uint64_t i = 2; i != 10; ++i) w.sub(w.mul(w.add(x, w.lit(i)), y), e);
+        e->set_value(7);
+
+        const Expr* roots[] = {e};
+        [[maybe_unused]] auto num_freed = w.gc(roots);
+        assert(num_freed == 8 * 4 && roots[0] == e && w.gid == 5 + 8 * 4);
+        assert(x->root() == e && y->root() == e && w.lit(1)->root() == e && !w.lit(2)->parent());
+        assert(w.mul(w.add(x, w.lit(1)), y) == e);
+
+        std::ostringstream before, after;
+        e->dump(before);
+        num_freed = w.gc(roots, true);
+        assert(num_freed == 1 && w.gid == 5); // w.lit(2) from above
+        e = roots[0];
+        e->dump(after);
+        assert(before.str() == after.str() && e->gid == 4 && e->value() == 7);
+        assert(w.id('x')->root() == e && w.lit(1)->gid == 0 && w.mul(w.add(w.id('x'), w.lit(1)), w.id('y')) == e);
+    }
+    {   // snapshots: a CFG with a hole in the gids
+        World w;
+        auto entry = w.bb();
+        auto head  = w.bb();
+        auto i     = w.id('i');
+        w.lit(23); // dies
+        entry->set(w.br(w.eq(i, w.lit(42)), head, w.jmp(w.id('r'), i)));
+        head->set(w.jmp(w.id('r'), w.lit(0)));
+        head->set_value(3);
+        const Expr* roots[] = {entry};
+        w.gc(roots);
+        [[maybe_unused]] auto num_gids = size_t(w.gid);
+        auto file = (std::filesystem::temp_directory_path() / "lcexpr_snapshot.bin").string();
+
+        for (auto aux : {true, false}) {
+            [[maybe_unused]] bool saved = w.save(file, aux);
+            assert(saved);
+            World l;
+            auto exprs = l.load(file);
+            assert(exprs.size() == num_gids && l.gid == num_gids && !exprs[3]);
+            [[maybe_unused]] auto le = exprs[entry->gid];
+            [[maybe_unused]] auto li = exprs[i->gid];
+            assert(le->gid == entry->gid && le->op(0)->op(1) == exprs[head->gid]);
+            assert(l.eq(l.id('i'), l.lit(42)) == le->op(0)->op(0) && l.gid == num_gids);
+            assert(li->parent()->gid == i->parent()->gid && exprs[head->gid]->parent() == le->op(0));
+            if (aux) assert(exprs[head->gid]->value() == 3 && li->root()->gid == i->root()->gid);
+        }
+
+        // malformed files
+        std::ostringstream oss;
+        w.save(oss);
+        auto image   = oss.str();
+        [[maybe_unused]] auto corrupt = [&](std::string bytes) {
+            std::ofstream(file, std::ios::binary) << bytes;
+            World l;
+            return l.load(file).empty() && l.gid == 0;
+        };
+        assert(corrupt("not a snapshot"));
+        assert(corrupt(image.substr(0, image.size() - 1)));
+        using Snapshot = World::Snapshot;
+        auto header    = Snapshot::Header();
+        std::memcpy(&header, image.data(), sizeof(header));
+        // make the binary Tag::Eq unary
+        auto unary = image;
+        auto eq    = header.num_exprs;
+        for (size_t i = 0; i != header.num_exprs && eq == header.num_exprs; ++i)
+            if (unary[sizeof(Snapshot::Header) + i * sizeof(Snapshot::Node) + offsetof(Snapshot::Node, tag)] == char(Tag::Eq)) eq = i;
+        assert(eq != header.num_exprs);
+        unary[sizeof(Snapshot::Header) + eq * sizeof(Snapshot::Node) + offsetof(Snapshot::Node, tag)] = char(Tag::Minus);
+        assert(corrupt(unary));
+        // the Aux of the last Expr - the Tag::Jmp of head - comes last: make it its own rep parent
+        auto last = uint32_t(num_gids - 1);
+        std::memcpy(image.data() + image.size() - sizeof(Snapshot::Aux) + offsetof(Snapshot::Aux, parent), &last, sizeof(last));
+        assert(corrupt(image));
+        // a cycle among immutable Expr%s: in a, b = -a, c = -b - saved with Aux - make b = -c and a its own rep root
+        World d;
+        d.minus(d.minus(d.id('a')));
+        std::ostringstream doss;
+        d.save(doss, true);
+        auto cyclic = doss.str();
+        assert(!corrupt(cyclic));
+        // the operands of b and c follow the 3 Node%s; then comes the Aux of a
+        auto ops = sizeof(Snapshot::Header) + 3 * sizeof(Snapshot::Node);
+        auto c = uint32_t(2), nil = uint32_t(-1);
+        std::memcpy(cyclic.data() + ops, &c, sizeof(c));
+        std::memcpy(cyclic.data() + ops + 2 * sizeof(uint32_t) + offsetof(Snapshot::Aux, parent), &nil, sizeof(nil));
+        assert(corrupt(cyclic));
+        std::filesystem::remove(file);
+        assert(World().load(file).empty());
+    }
+    {   // tape: compare against a recursive interpreter over more than one batch
+        World w;
+        auto x = w.id('x');
+        auto y = w.id('y');
+        auto s = w.mul(w.add(x, w.lit(3)), w.plus(y));
+        auto e = w.sub(w.add(s, w.select(w.eq(x, y), w.minus(s), w.lit(7))), w.mul(s, s));
+
+        auto tape = Tape::compile(e);
+        assert(std::ranges::equal(tape.ids(), std::string("xy")) && tape.num_regs() <= 5);
+
+        std::vector<uint64_t> xs, ys, out(1000);
+        for (uint64_t i = 0; i != out.size(); ++i) {
+            xs.emplace_back(i % 7 == 0 ? i : i * 0x9e3779b97f4a7c15);
+            ys.emplace_back(i % 7 == 0 ? i : i >> 2);
+        }
+        const uint64_t* inputs[] = {xs.data(), ys.data()};
+        tape.eval(inputs, out.data(), out.size());
+
+        [[maybe_unused]] auto interpret = [&](auto& self, const Expr* e, uint64_t x, uint64_t y) -> uint64_t {
+            auto op = [&](size_t i) { return self(self, e->op(i), x, y); };
+            switch (e->tag) {
+                case Tag::Lit: return e->stuff;
+                case Tag::Id: return e->stuff == 'x' ? x : y;
+                case Tag::Minus: return 0 - op(0);
+                case Tag::Plus: return op(0);
+                case Tag::Add: return op(0) + op(1);
+                case Tag::Sub: return op(0) - op(1);
+                case Tag::Mul: return op(0) * op(1);
+                case Tag::Eq: return op(0) == op(1);
+                case Tag::Select: return op(0) ? op(1) : op(2);
+                default: return 0;
+            }
+        };
+        for ([[maybe_unused]] size_t i = 0; i != out.size(); ++i) assert(out[i] == interpret(interpret, e, xs[i], ys[i]));
+        assert(tape.eval(std::vector<uint64_t>{2, 2}) == 10 + uint64_t(-10) - 100);
+        assert(Tape::compile(w.plus(w.lit(5))).eval(std::span<const uint64_t>()) == 5);
+    }
+    {   // global code motion: hoist loop-invariant code out of the loop, keep the rest - and loop-carried values - in place
+        World w;
+        auto entry = w.bb();
+        auto head  = w.bb();
+        auto body  = w.bb();
+        auto exit  = w.bb();
+        auto other = w.bb();
+        auto x = w.id('x'), y = w.id('y'), i = w.id('i'), r = w.id('r');
+        auto c    = w.eq(x, w.lit(0));
+        auto cond = w.eq(i, w.lit(42));
+        auto inv  = w.add(w.mul(x, y), i);
+        auto diff = w.sub(x, y);
+        auto tail = w.mul(diff, w.lit(7));
+        entry->set(w.br(c, head, other));
+        head->set(w.br(cond, body, exit));
+        body->set(w.jmp(head, inv));
+        exit->set(w.jmp(r, w.add(tail, x)));
+        other->set(w.jmp(r, diff));
+
+        DomTree dom(entry);
+        auto params = std::array{std::pair<const Expr*, const Expr*>{head, i}}; // body passes inv to head as i
+        GCM gcm(dom, params);
+        assert(gcm.size() == 7 && gcm.loop_depth(head) == 1 && gcm.loop_depth(body) == 1 && gcm.loop_depth(exit) == 0);
+        assert(gcm.early(inv) == head && gcm.late(inv) == body && gcm.block(inv) == body);
+        assert(gcm.early(cond) == head && gcm.block(cond) == head && gcm.block(c) == entry);
+        assert(gcm.early(w.mul(x, y)) == entry && gcm.late(w.mul(x, y)) == body && gcm.block(w.mul(x, y)) == entry);
+        assert(gcm.late(diff) == entry && gcm.block(diff) == entry);
+        assert(gcm.block(tail) == exit && gcm.block(w.add(tail, x)) == exit);
+        assert(gcm.schedule(head).size() == 1 && gcm.schedule(body).size() == 1 && gcm.schedule(exit).size() == 2);
+        assert(gcm.schedule(exit)[0] == tail);
+    }
     {
         World w;
         auto a = w.bb();
@@ -166,5 +660,8 @@ int main() {
         a->dot();
         b->set(a);
         a->dot();
+
+        DomTree dom(b);
+        assert(dom.idom(a) == b && dom.lca(a, b) == b && !dom.is_reachable(w.bb()));
     }
 }
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+
+#include <algorithm>
+#include <ostream>
+
+/// Hot-path counters of LinkCutTree and World.
+/// They are only maintained if compiled with `LCEXPR_STATS` (CMake option of the same name);
+/// otherwise, all `if constexpr (stats::enabled)` blocks that bump them compile to nothing.
+/// The counters are thread-local, so bumping them is a plain increment.
+/// @note As a consequence, all LinkCutTree%s and World%s of a thread share the same counters.
+namespace stats {
+
+#ifdef LCEXPR_STATS
+inline constexpr bool enabled = true;
+#else
+inline constexpr bool enabled = false;
+#endif
+
+struct Counters {
+    /// @name LinkCutTree::splay
+    ///@{
+    uint64_t num_splays      = 0;
+    uint64_t num_rotations   = 0;
+    uint64_t splay_depth     = 0; ///< Sum of the depths the splayed nodes started from.
+    uint64_t max_splay_depth = 0;
+    ///@}
+
+    /// @name LinkCutTree::expose
+    ///@{
+    uint64_t num_exposes = 0;
+    uint64_t num_hops    = 0; ///< Preferred-path changes, i.e. path-parent hops.
+    uint64_t max_hops    = 0;
+    ///@}
+
+    /// @name LinkCutTree::root
+    ///@{
+    uint64_t num_root_walks = 0;
+    uint64_t root_walk      = 0; ///< Sum of the number of nodes walked down.
+    uint64_t max_root_walk  = 0;
+    ///@}
+
+    /// @name World::put
+    ///@{
+    uint64_t num_puts  = 0;
+    uint64_t num_hits  = 0;
+    uint64_t probe     = 0; ///< Sum of the probe lengths of the found or inserted Expr%s.
+    uint64_t max_probe = 0;
+    ///@}
+
+    std::ostream& dump(std::ostream& os) const {
+        auto avg = [](uint64_t sum, uint64_t n) { return n ? double(sum) / double(n) : 0.0; };
+        os << "splay:  " << num_splays << " splays, " << avg(num_rotations, num_splays) << " rotations/splay, depth avg "
+           << avg(splay_depth, num_splays) << " max " << max_splay_depth << std::endl;
+        os << "expose: " << num_exposes << " exposes, hops avg " << avg(num_hops, num_exposes) << " max " << max_hops
+           << std::endl;
+        os << "root:   " << num_root_walks << " walks, length avg " << avg(root_walk, num_root_walks) << " max "
+           << max_root_walk << std::endl;
+        os << "put:    " << num_puts << " puts, " << avg(num_hits, num_puts) * 100.0 << "% hits, probe avg "
+           << avg(probe, num_puts) << " max " << max_probe << std::endl;
+        return os;
+    }
+};
+
+inline Counters& counters() {
+    thread_local Counters counters;
+    return counters;
+}
+
+/// Adds @p value to the counter @p sum and keeps track of its maximum in @p max.
+inline void sample(uint64_t& sum, uint64_t& max, uint64_t value) {
+    sum += value;
+    max = std::max(max, value);
+}
+
+} // namespace stats
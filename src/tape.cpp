@@ -0,0 +1,247 @@
+#include "tape.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#    include <immintrin.h>
+#    define TAPE_AVX2 1
+#endif
+
+/*
+ * compile
+ */
+
+Tape Tape::compile(const Expr* root) {
+    auto strip = [](const Expr* e) {
+        while (e->tag == Tag::Plus) e = e->op(0);
+        return e;
+    };
+
+    // post-order without Tag::Plus; uses[e] counts the remaining uses of e's register
+    std::vector<const Expr*> order;
+    ExprMap<uint32_t> uses;
+    std::vector<std::pair<const Expr*, size_t>> stack; // Expr + next operand to visit
+    auto visit = [&](const Expr* e) {
+        e = strip(e);
+        if (uses[e]++ == 0) stack.emplace_back(e, 0);
+    };
+    visit(root); // the result is never freed
+    while (!stack.empty()) {
+        auto& [e, i] = stack.back();
+        assert(!e->mut && e->tag <= Tag::Select && "Tape only supports pure arithmetic");
+        if (i != e->num_ops) {
+            visit(e->op(i++)); // may invalidate e and i
+        } else {
+            order.emplace_back(e);
+            stack.pop_back();
+        }
+    }
+
+    Tape tape;
+    ExprMap<uint32_t> reg;
+    std::vector<uint32_t> free;
+    auto alloc = [&]() {
+        if (free.empty()) return tape.num_regs_++;
+        auto r = free.back();
+        free.pop_back();
+        return r;
+    };
+
+    for (auto e : order) {
+        if (e->tag == Tag::Lit) {
+            tape.lits_.emplace_back(reg[e] = tape.num_regs_++, e->stuff);
+            continue;
+        }
+
+        Instr instr = {};
+        if (e->tag == Tag::Id) {
+            auto i       = std::ranges::find(tape.ids_, char(e->stuff)) - tape.ids_.begin();
+            instr.src[0] = uint32_t(i);
+            if (size_t(i) == tape.ids_.size()) tape.ids_.emplace_back(char(e->stuff));
+        } else {
+            for (size_t i = 0; i != e->num_ops; ++i) {
+                auto op      = strip(e->op(i));
+                instr.src[i] = reg[op];
+                if (--uses[op] == 0 && op->tag != Tag::Lit) free.emplace_back(instr.src[i]);
+            }
+        }
+
+        // clang-format off
+        switch (e->tag) {
+            case Tag::Id:     instr.op = Op::Id;     break;
+            case Tag::Minus:  instr.op = Op::Minus;  break;
+            case Tag::Add:    instr.op = Op::Add;    break;
+            case Tag::Sub:    instr.op = Op::Sub;    break;
+            case Tag::Mul:    instr.op = Op::Mul;    break;
+            case Tag::Eq:     instr.op = Op::Eq;     break;
+            case Tag::Select: instr.op = Op::Select; break;
+            default: assert(false && "unreachable");
+        }
+        // clang-format on
+
+        // operands are freed first, so the result may overwrite one of them - each lane reads before it writes
+        instr.dst = reg[e] = alloc();
+        tape.instrs_.emplace_back(instr);
+    }
+
+    tape.result_ = reg[strip(root)];
+    return tape;
+}
+
+/*
+ * eval
+ */
+
+namespace {
+
+using Instr = Tape::Instr;
+using Op    = Tape::Op;
+
+/// Runs @p instrs on the first @p n lanes of @p regs; Op::Id reads from `inputs[i] + base`.
+void run_scalar(std::span<const Instr> instrs,
+                std::span<const uint64_t* const> inputs,
+                size_t base,
+                uint64_t* regs,
+                size_t n) {
+    auto r = [&](uint32_t i) { return regs + i * Tape::Lanes; };
+    for (auto [op, dst, src] : instrs) {
+        auto d = r(dst);
+        if (op == Op::Id) {
+            std::copy_n(inputs[src[0]] + base, n, d);
+            continue;
+        }
+
+        auto a = r(src[0]), b = r(src[1]), c = r(src[2]);
+        // clang-format off
+        switch (op) {
+            case Op::Id:                                                                break;
+            case Op::Minus:  for (size_t k = 0; k != n; ++k) d[k] = 0 - a[k];           break;
+            case Op::Add:    for (size_t k = 0; k != n; ++k) d[k] = a[k] + b[k];        break;
+            case Op::Sub:    for (size_t k = 0; k != n; ++k) d[k] = a[k] - b[k];        break;
+            case Op::Mul:    for (size_t k = 0; k != n; ++k) d[k] = a[k] * b[k];        break;
+            case Op::Eq:     for (size_t k = 0; k != n; ++k) d[k] = a[k] == b[k];       break;
+            case Op::Select: for (size_t k = 0; k != n; ++k) d[k] = a[k] ? b[k] : c[k]; break;
+        }
+        // clang-format on
+    }
+}
+
+#ifdef TAPE_AVX2
+// lambdas don't inherit the target attribute
+__attribute__((target("avx2"))) __m256i ld(const uint64_t* p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+__attribute__((target("avx2"))) void st(uint64_t* p, __m256i v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+
+/// Same as run_scalar but 4 lanes at a time; rounds @p n up to a multiple of 4 for all but Op::Id.
+__attribute__((target("avx2"))) void run_avx2(std::span<const Instr> instrs,
+                                              std::span<const uint64_t* const> inputs,
+                                              size_t base,
+                                              uint64_t* regs,
+                                              size_t n) {
+    auto r    = [&](uint32_t i) { return regs + i * Tape::Lanes; };
+    auto zero = _mm256_setzero_si256();
+    size_t n4 = (n + 3) & ~size_t(3);
+
+    for (auto [op, dst, src] : instrs) {
+        auto d = r(dst);
+        if (op == Op::Id) {
+            std::copy_n(inputs[src[0]] + base, n, d);
+            continue;
+        }
+
+        auto a = r(src[0]), b = r(src[1]), c = r(src[2]);
+        switch (op) {
+            case Op::Id: break;
+            case Op::Minus:
+                for (size_t k = 0; k != n4; k += 4) st(d + k, _mm256_sub_epi64(zero, ld(a + k)));
+                break;
+            case Op::Add:
+                for (size_t k = 0; k != n4; k += 4) st(d + k, _mm256_add_epi64(ld(a + k), ld(b + k)));
+                break;
+            case Op::Sub:
+                for (size_t k = 0; k != n4; k += 4) st(d + k, _mm256_sub_epi64(ld(a + k), ld(b + k)));
+                break;
+            case Op::Mul:
+                // AVX2 only multiplies 32-bit halves: lo(a)*lo(b) + (hi(a)*lo(b) + lo(a)*hi(b)) << 32
+                for (size_t k = 0; k != n4; k += 4) {
+                    auto x = ld(a + k), y = ld(b + k);
+                    auto lo    = _mm256_mul_epu32(x, y);
+                    auto cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(x, 32), y),
+                                                  _mm256_mul_epu32(x, _mm256_srli_epi64(y, 32)));
+                    st(d + k, _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32)));
+                }
+                break;
+            case Op::Eq:
+                for (size_t k = 0; k != n4; k += 4)
+                    st(d + k, _mm256_srli_epi64(_mm256_cmpeq_epi64(ld(a + k), ld(b + k)), 63));
+                break;
+            case Op::Select:
+                for (size_t k = 0; k != n4; k += 4) {
+                    auto is_zero = _mm256_cmpeq_epi64(ld(a + k), zero);
+                    st(d + k, _mm256_blendv_epi8(ld(b + k), ld(c + k), is_zero));
+                }
+                break;
+        }
+    }
+}
+#endif
+
+using Kernel = void (*)(std::span<const Instr>, std::span<const uint64_t* const>, size_t, uint64_t*, size_t);
+
+Kernel kernel() {
+#ifdef TAPE_AVX2
+    static const Kernel k = __builtin_cpu_supports("avx2") ? run_avx2 : run_scalar;
+    return k;
+#else
+    return run_scalar;
+#endif
+}
+
+} // namespace
+
+void Tape::eval(std::span<const uint64_t* const> inputs, uint64_t* out, size_t n) const {
+    assert(inputs.size() == ids_.size());
+    // zero-initialized: lanes past n in the last batch are computed but never read
+    std::vector<uint64_t> regs(num_regs_ * Lanes);
+    for (auto [r, val] : lits_) std::fill_n(regs.data() + r * Lanes, Lanes, val);
+
+    auto run = kernel();
+    for (size_t base = 0; base < n; base += Lanes) {
+        auto m = std::min(Lanes, n - base);
+        run(instrs_, inputs, base, regs.data(), m);
+        std::copy_n(regs.data() + result_ * Lanes, m, out + base);
+    }
+}
+
+uint64_t Tape::eval(std::span<const uint64_t> inputs) const {
+    std::vector<const uint64_t*> ptrs;
+    for (auto& i : inputs) ptrs.emplace_back(&i);
+    uint64_t res;
+    eval(ptrs, &res, 1);
+    return res;
+}
+
+/*
+ * dump
+ */
+
+std::ostream& Tape::dump(std::ostream& o) const {
+    for (auto [r, val] : lits_) o << 'r' << r << " = " << val << '\n';
+    for (auto [op, dst, src] : instrs_) {
+        o << 'r' << dst << " = ";
+        // clang-format off
+        switch (op) {
+            case Op::Id:     o << ids_[src[0]];                                                 break;
+            case Op::Minus:  o << "-r" << src[0];                                               break;
+            case Op::Add:    o << 'r' << src[0] << " + "  << 'r' << src[1];                     break;
+            case Op::Sub:    o << 'r' << src[0] << " - "  << 'r' << src[1];                     break;
+            case Op::Mul:    o << 'r' << src[0] << " * "  << 'r' << src[1];                     break;
+            case Op::Eq:     o << 'r' << src[0] << " == " << 'r' << src[1];                     break;
+            case Op::Select: o << 'r' << src[0] << " ? r" << src[1] << " : r" << src[2];        break;
+        }
+        // clang-format on
+        o << '\n';
+    }
+    return o << "return r" << result_ << '\n';
+}
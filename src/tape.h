@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+
+#include <ostream>
+#include <span>
+#include <vector>
+
+#include "expr.h"
+
+/// Straight-line program that evaluates an Expr DAG over `uint64_t`s - one instruction per distinct Expr.
+/// * Tape::compile orders the Expr%s topologically and hands out *registers* with a linear scan:
+///     a register is free again after the last use of its value, so the register count tracks the width of the DAG,
+///     not its size. Tag::Plus costs nothing, and each Tag::Lit is materialized once per Tape::eval.
+/// * Tape::eval runs the Tape over batches of Tape::Lanes bindings: each instruction is a tight loop over whole registers.
+///     On x86-64 CPUs with AVX2, these loops use 256-bit vectors - chosen at runtime, so no special build flags are needed;
+///     elsewhere, they are plain loops the compiler may vectorize on its own.
+///
+/// Arithmetic wraps around; Tag::Eq yields `0` or `1` and Tag::Select picks its second operand if the first one is not `0`.
+class Tape {
+public:
+    static constexpr size_t Lanes = 256; ///< Bindings per batch; a register holds one value per lane.
+
+    enum class Op : uint8_t { Id, Minus, Add, Sub, Mul, Eq, Select };
+
+    struct Instr {
+        Op op;
+        uint32_t dst;
+        uint32_t src[3]; ///< Registers; Op::Id holds the index into Tape::ids instead.
+    };
+
+    /// Compiles the Expr%s reachable from @p root, which must only consist of `Lit/Id/Minus/Plus/Add/Sub/Mul/Eq/Select`.
+    static Tape compile(const Expr* root);
+
+    /// @name Getters
+    ///@{
+    std::span<const char> ids() const { return ids_; } ///< Inputs in order of first use.
+    std::span<const Instr> instrs() const { return instrs_; }
+    size_t num_regs() const { return num_regs_; }
+    ///@}
+
+    /// Evaluates this Tape for @p n bindings: `inputs[i][k]` is the value of `ids()[i]` in binding `k`; `out[k]` gets the result.
+    void eval(std::span<const uint64_t* const> inputs, uint64_t* out, size_t n) const;
+    /// Single binding: `inputs[i]` is the value of `ids()[i]`.
+    uint64_t eval(std::span<const uint64_t> inputs) const;
+
+    std::ostream& dump(std::ostream&) const;
+
+private:
+    std::vector<char> ids_;
+    std::vector<Instr> instrs_;
+    std::vector<std::pair<uint32_t, uint64_t>> lits_; ///< Register + value; these registers are never reused.
+    uint32_t num_regs_ = 0;
+    uint32_t result_   = 0;
+};
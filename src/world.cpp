@@ -0,0 +1,589 @@
+#include "world.h"
+
+#include <cstring>
+
+#include <fstream>
+#include <ranges>
+
+#ifdef __unix__
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+size_t World::gc(std::span<const Expr*> roots, bool compact) {
+    assert(marks_.empty() && "World::gc during a World::checkpoint");
+    assert(std::ranges::all_of(shards_, [](const Shard& shard) { return shard.fresh.empty(); })
+           && "call World::link first");
+
+    std::vector<bool> live;
+    auto order = mark(roots, live);
+
+    std::vector<Expr*> dead;
+    for (auto& shard : shards_) {
+        for (auto i = shard.set.begin(); i != shard.set.end();) {
+            if (live[(*i)->gid]) {
+                ++i;
+            } else {
+                dead.emplace_back(const_cast<Expr*>(*i));
+                i = shard.set.erase(i);
+            }
+        }
+    }
+
+    if (compact) {
+        this->compact(order, roots);
+        return dead.size();
+    }
+
+    // all dead nodes are still intact: detach the live ones that hang below them
+    for (auto expr : dead) {
+        expr->remove_uses();
+        for (auto op : expr->ops())
+            if (op && live[op->gid] && op->parent() == expr) op->cut();
+    }
+
+    for (auto expr : dead) shard_of(expr->hash).arena.deallocate(expr, Expr::size_of(expr->num_ops));
+    return dead.size();
+}
+
+/// Marks all Expr%s reachable from @p roots in @p live - indexed by Expr::gid - and returns them in post-order.
+std::vector<const Expr*> World::mark(std::span<const Expr* const> roots, std::vector<bool>& live) const {
+    std::vector<const Expr*> order;
+    std::vector<std::pair<const Expr*, size_t>> stack; // Expr + next operand to visit
+    live.assign(gid, false);
+
+    auto push = [&](const Expr* expr) {
+        if (expr && !live[expr->gid]) {
+            live[expr->gid] = true;
+            stack.emplace_back(expr, 0);
+        }
+    };
+
+    for (auto root : roots) {
+        push(root);
+        while (!stack.empty()) {
+            auto& [expr, i] = stack.back();
+            if (i != expr->num_ops) {
+                push(expr->op(i++)); // may invalidate expr and i
+            } else {
+                order.emplace_back(expr);
+                stack.pop_back();
+            }
+        }
+    }
+
+    return order;
+}
+
+/// Moves the survivors in @p order into fresh Shard%s and renumbers them.
+void World::compact(std::span<const Expr* const> order, std::span<const Expr*> roots) {
+    std::deque<Shard> shards;
+    for (size_t i = 0, e = shards_.size(); i != e; ++i) shards.emplace_back(this);
+    shards_.swap(shards); // the old Shard%s - and their Arena%s - die at the end of this function
+
+    std::vector<Expr*> old2new(gid, nullptr);
+    std::vector<Expr*> copies;
+    copies.reserve(order.size());
+    for (auto old : order) {
+        auto g    = uint32_t(copies.size());
+        auto mem  = shard_of(old->hash).arena.allocate(Expr::size_of(old->num_ops));
+        auto copy = old->mut ? new (mem) Expr(g, old->hash) : new (mem) Expr(g, old->tag, old->ops(), old->stuff, old->hash);
+        if (old->mut) std::ranges::copy(old->ops(), copy->ops().begin());
+        if (auto v = old->value()) copy->set_value(v);
+        old2new[old->gid] = copy;
+        copies.emplace_back(copy);
+    }
+
+    for (auto copy : copies) {
+        for (auto& op : copy->ops())
+            if (op) op = old2new[op->gid];
+        copy->add_uses();
+        shard_of(copy->hash).set.insert_unique(copy);
+    }
+
+    // like World::link but Tag::BB%s may close cycles
+    for (auto copy : copies)
+        for (auto op : copy->ops())
+            if (op && !copy->connected(op)) copy->link(op);
+
+    for (auto& root : roots)
+        if (root) root = old2new[root->gid];
+    gid = copies.size();
+}
+
+/*
+ * Bulk Construction
+ */
+
+std::vector<const Expr*> World::build(std::span<const Instr> instrs) {
+    assert(!concurrent_ && "World::build requires a single-threaded World");
+
+    // validate first, so a malformed program leaves this World untouched
+    size_t depth = 0;
+    for (auto [tag, _] : instrs) {
+        auto n = arity(tag);
+        if (tag >= Tag::BB || depth < n) return {};
+        depth = depth - n + 1;
+    }
+
+    auto& shard = shards_.front();
+    shard.set.reserve(shard.set.size() + instrs.size());
+
+    auto base = uint32_t(gid);  // Expr%s with a gid below base are old
+    std::vector<bool> attached; // new Expr -> has a *rep* parent; indexed by gid - base
+    ExprSet seen;               // old operands - only these, so a small program stays cheap in a large World
+    std::vector<std::pair<const Expr*, const Expr*>> olds; // first new user + old operand
+    std::vector<const Expr*> stack;
+
+    auto make = [&](Tag tag, std::span<const Expr* const> ops, uint64_t stuff) {
+        auto [expr, fresh] = intern(shard, Key{tag, ops, stuff, Expr::hash_of(tag, ops, stuff)});
+        if (!fresh) return expr;
+
+        attached.emplace_back(false);
+        for (auto op : ops) {
+            if (op->gid >= base) {
+                if (!attached[op->gid - base]) {
+                    attached[op->gid - base] = true;
+                    expr->attach(op);
+                }
+            } else if (seen.insert(op).second) {
+                olds.emplace_back(expr, op);
+            }
+        }
+        return expr;
+    };
+
+    for (auto [tag, stuff] : instrs) {
+        auto n = arity(tag);
+        std::array<const Expr*, 3> ops;
+        std::copy(stack.end() - n, stack.end(), ops.begin());
+        stack.resize(stack.size() - n);
+
+        if (tag == Tag::Add) {
+            if (auto res = fold_add(ops[0], ops[1], [&](uint64_t u) { return make(Tag::Lit, {}, u); })) {
+                stack.emplace_back(res);
+                continue;
+            }
+        }
+        stack.emplace_back(make(tag, std::span(ops).first(n), tag == Tag::Lit || tag == Tag::Id ? stuff : 0));
+    }
+
+    // old *rep* roots go below their first new user; old Expr%s never use new ones, so this can't close a cycle
+    for (auto [user, op] : olds)
+        if (!op->parent()) user->link(op);
+    return stack;
+}
+
+/*
+ * Uses
+ */
+
+void World::replace_all_uses_with(const Expr* old, const Expr* nu) {
+    assert(!concurrent_ && "World::replace_all_uses_with requires a single-threaded World");
+    assert(old && nu);
+
+    std::vector<std::pair<const Expr*, const Expr*>> todo = {{old, nu}}; // old + its replacement
+    std::vector<Expr*> users, order, merged;
+
+    // links e below user in the *rep* forest - unless this would close a cycle
+    auto adopt = [](const Expr* user, const Expr* e) {
+        if (!e->parent() && !user->connected(e)) user->link(e);
+    };
+
+    while (!todo.empty()) {
+        auto [old, nu] = todo.back();
+        todo.pop_back();
+        if (old == nu) continue;
+
+        users.clear();
+        while (!old->uses().empty()) {
+            auto& use = *old->uses().begin();
+            auto user = const_cast<Expr*>(use.user());
+            assert(user != nu && "replacement must not use the replaced Expr");
+            if (old->parent() == user) old->cut();
+            user->set_op(use.index(), nu); // moves use to the use-list of nu
+            adopt(user, nu);
+            if (!user->mut) users.emplace_back(user);
+        }
+
+        // Expr::hash is a Merkle hash: all immutable Expr%s above these users have to follow - operands before users
+        users_above(users, order);
+        for (auto user : order) {
+            if (shard_of(user->hash).set.erase(Ptr{user}) == 0) continue; // already merged
+            if (!marks_.empty() && user->gid < marks_.back().gid) hashes_.emplace_back(user, user->hash);
+
+            if (user->tag == Tag::Add && !in_order(user->op(0), user->op(1))) {
+                auto a = user->op(0), b = user->op(1);
+                user->set_op(0, b);
+                user->set_op(1, a);
+            }
+
+            auto key  = Key{user->tag, user->ops(), user->stuff, Expr::hash_of(user->tag, user->ops(), user->stuff)};
+            auto& set = shard_of(key.hash).set;
+            if (auto i = set.find(key); i != set.end()) {
+                // merge user into its duplicate, which takes over the operands that hang below user
+                auto dup = *i;
+                for (size_t o = 0, e = user->num_ops; o != e; ++o) {
+                    auto op = user->op(o);
+                    if (op->parent() == user) op->cut();
+                    user->set_op(o, nullptr);
+                    adopt(dup, op);
+                }
+                todo.emplace_back(user, dup);
+                merged.emplace_back(user);
+            } else {
+                user->hash = key.hash;
+                set.insert_unique(user);
+            }
+        }
+    }
+
+    // merged Expr%s are out of the table and all use-lists now; World::rollback may still need them, though
+    if (marks_.empty()) {
+        for (auto expr : merged) shard_of(expr->hash).arena.deallocate(expr, Expr::size_of(expr->num_ops));
+    } else {
+        merged_.insert(merged_.end(), merged.begin(), merged.end());
+    }
+}
+
+/// Collects @p roots and all immutable Expr%s that (transitively) use them into @p order - operands before users.
+void World::users_above(std::span<Expr* const> roots, std::vector<Expr*>& order) const {
+    ExprSet visited;
+    std::vector<std::pair<Expr*, Expr::Uses::iterator>> stack; // Expr + next Use to visit
+    order.clear();
+
+    for (auto root : roots) {
+        if (!visited.insert(root).second) continue;
+        stack.emplace_back(root, root->uses().begin());
+        while (!stack.empty()) {
+            auto& [expr, i] = stack.back();
+            if (i != expr->uses().end()) {
+                auto user = const_cast<Expr*>((i++)->user());
+                if (!user->mut && visited.insert(user).second)
+                    stack.emplace_back(user, user->uses().begin()); // invalidates expr and i
+            } else {
+                order.emplace_back(expr);
+                stack.pop_back();
+            }
+        }
+    }
+    std::ranges::reverse(order);
+}
+
+/*
+ * Speculation
+ */
+
+void World::checkpoint() {
+    assert(!concurrent_ && "World::checkpoint requires a single-threaded World");
+    assert((!Expr::speculating || Expr::speculating == this) && "another World speculates on this thread");
+    marks_.emplace_back(Mark{auxs_.size(), ops_.size(), hashes_.size(), exprs_.size(), merged_.size(), gid});
+    ++serial_;
+    Expr::speculating = this;
+}
+
+void World::rollback() {
+    assert(!marks_.empty() && "no World::checkpoint to roll back to");
+    auto mark         = marks_.back();
+    Expr::speculating = nullptr; // restoring must not journal itself
+
+    for (size_t i = auxs_.size(); i-- != mark.num_auxs;) {
+        auto& [expr, aux] = auxs_[i];
+        static_cast<Expr::LinkCutTree&>(*const_cast<Expr*>(expr)) = aux;
+    }
+    for (size_t i = ops_.size(); i-- != mark.num_ops;) {
+        auto [expr, o, op] = ops_[i];
+        expr->set_op(o, op);
+    }
+    // Expr::set_op may have left several Expr%s with the same content behind, so look for the pointer
+    for (size_t i = hashes_.size(); i-- != mark.num_hashes;) {
+        auto [expr, hash] = hashes_[i];
+        shard_of(expr->hash).set.erase(Ptr{expr});
+        expr->hash = hash;
+        shard_of(hash).set.insert_unique(expr);
+    }
+    // all new Expr%s leave the use-lists before any of them dies; World::replace_all_uses_with may have merged some already
+    for (size_t i = exprs_.size(); i-- != mark.num_exprs;) exprs_[i]->remove_uses();
+    for (size_t i = exprs_.size(); i-- != mark.num_exprs;) {
+        auto expr   = exprs_[i];
+        auto& shard = shard_of(expr->hash);
+        shard.set.erase(Ptr{expr});
+        shard.arena.deallocate(expr, Expr::size_of(expr->num_ops));
+    }
+
+    auxs_.resize(mark.num_auxs);
+    ops_.resize(mark.num_ops);
+    hashes_.resize(mark.num_hashes);
+    exprs_.resize(mark.num_exprs);
+    merged_.resize(mark.num_merged); // back in business - or among the new Expr%s that just died
+    gid = mark.gid;
+    marks_.pop_back();
+    ++serial_;
+    if (!marks_.empty()) Expr::speculating = this;
+}
+
+void World::commit() {
+    assert(!marks_.empty() && "no World::checkpoint to commit");
+    marks_.pop_back();
+    ++serial_;
+    if (marks_.empty()) {
+        auxs_.clear();
+        ops_.clear();
+        hashes_.clear();
+        exprs_.clear();
+        Expr::speculating = nullptr;
+        for (auto expr : merged_) shard_of(expr->hash).arena.deallocate(expr, Expr::size_of(expr->num_ops));
+        merged_.clear();
+    }
+}
+
+/*
+ * Snapshots
+ */
+
+namespace {
+
+using Header = World::Snapshot::Header;
+using Node   = World::Snapshot::Node;
+using Aux    = World::Snapshot::Aux;
+
+static_assert(sizeof(Header) == 40 && sizeof(Node) == 24 && sizeof(Aux) == 8, "no padding: these are written as is");
+
+constexpr uint64_t Magic = 0x3130'5250'5845'434c; ///< `LCEXPR01` in little endian.
+constexpr uint32_t Nil   = uint32_t(-1);
+
+template<class T>
+void write(std::ostream& os, std::span<const T> data) {
+    os.write(reinterpret_cast<const char*>(data.data()), std::streamsize(data.size_bytes()));
+}
+
+template<class T>
+T read(const std::byte* p) {
+    T res;
+    std::memcpy(&res, p, sizeof(T));
+    return res;
+}
+
+/// Read-only view of a whole file: memory-mapped on POSIX systems and read into a buffer elsewhere.
+class FileView {
+public:
+    FileView(const std::string& file) {
+#ifdef __unix__
+        int fd = ::open(file.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+#    ifdef MAP_POPULATE
+            int flags = MAP_PRIVATE | MAP_POPULATE; // we are going to read all of it anyway
+#    else
+            int flags = MAP_PRIVATE;
+#    endif
+            auto p = ::mmap(nullptr, size_t(st.st_size), PROT_READ, flags, fd, 0);
+            if (p != MAP_FAILED) {
+                ::madvise(p, size_t(st.st_size), MADV_SEQUENTIAL);
+                bytes_ = {static_cast<const std::byte*>(p), size_t(st.st_size)};
+            }
+        }
+        ::close(fd);
+#else
+        std::ifstream ifs(file, std::ios::binary | std::ios::ate);
+        if (!ifs) return;
+        buffer_.resize(size_t(ifs.tellg()));
+        ifs.seekg(0);
+        if (ifs.read(reinterpret_cast<char*>(buffer_.data()), std::streamsize(buffer_.size()))) bytes_ = buffer_;
+#endif
+    }
+    FileView(const FileView&)            = delete;
+    FileView& operator=(const FileView&) = delete;
+    ~FileView() {
+#ifdef __unix__
+        if (!bytes_.empty()) ::munmap(const_cast<std::byte*>(bytes_.data()), bytes_.size());
+#endif
+    }
+
+    std::span<const std::byte> bytes() const { return bytes_; }
+
+private:
+    std::span<const std::byte> bytes_;
+#ifndef __unix__
+    std::vector<std::byte> buffer_;
+#endif
+};
+
+} // namespace
+
+void World::save(std::ostream& os, bool aux) const {
+    assert(std::ranges::all_of(shards_, [](const Shard& shard) { return shard.fresh.empty(); })
+           && "call World::link first");
+
+    std::vector<const Expr*> exprs(gid, nullptr);
+    for (auto& shard : shards_)
+        for (auto expr : shard.set) exprs[expr->gid] = expr;
+    std::erase(exprs, nullptr);
+
+    auto header = Header{Magic, gid, exprs.size(), 0, aux};
+    std::vector<Node> nodes;
+    std::vector<uint32_t> ops;
+    nodes.reserve(exprs.size());
+    for (auto expr : exprs) {
+        nodes.emplace_back(Node{expr->gid, expr->tag, expr->mut, expr->num_ops, 0, expr->stuff, expr->hash});
+        for (auto op : expr->ops()) ops.emplace_back(op ? op->gid : Nil);
+    }
+    header.num_ops = ops.size();
+
+    write(os, std::span<const Header>(&header, 1));
+    write<Node>(os, nodes);
+    write<uint32_t>(os, ops);
+    if (aux) {
+        std::vector<Aux> auxs;
+        auxs.reserve(exprs.size());
+        for (auto expr : exprs) {
+            auto parent = expr->parent();
+            auxs.emplace_back(Aux{parent ? parent->gid : Nil, expr->value()});
+        }
+        write<Aux>(os, auxs);
+    }
+}
+
+bool World::save(const std::string& file, bool aux) const {
+    std::ofstream ofs(file, std::ios::binary);
+    save(ofs, aux);
+    return bool(ofs.flush());
+}
+
+std::vector<const Expr*> World::load(const std::string& file) {
+    assert(gid == 0 && "World::load expects an empty World");
+    assert(marks_.empty() && "World::load during a World::checkpoint");
+
+    FileView view(file);
+    auto bytes = view.bytes();
+    if (bytes.size() < sizeof(Header)) return {};
+
+    auto header = read<Header>(bytes.data());
+    if (header.magic != Magic || header.num_gids > UINT32_MAX || header.num_exprs > header.num_gids) return {};
+    if (header.num_ops > bytes.size()
+        || sizeof(Header) + header.num_exprs * (sizeof(Node) + (header.aux ? sizeof(Aux) : 0))
+                   + header.num_ops * sizeof(uint32_t)
+               != bytes.size())
+        return {};
+    auto nodes_begin = bytes.data() + sizeof(Header);
+    auto ops_begin   = nodes_begin + header.num_exprs * sizeof(Node);
+    auto aux_begin   = ops_begin + header.num_ops * sizeof(uint32_t);
+    auto node = [&](size_t i) { return read<Node>(nodes_begin + i * sizeof(Node)); };
+    auto op   = [&](size_t i) { return read<uint32_t>(ops_begin + i * sizeof(uint32_t)); };
+    auto aux  = [&](size_t i) { return read<Aux>(aux_begin + i * sizeof(Aux)); };
+
+    // validate everything first, so an invalid file leaves this World untouched
+    std::vector<uint32_t> index(header.num_gids, Nil); // gid -> index into the Node%s
+    std::vector<size_t> first_op(header.num_exprs + 1, 0);
+    std::vector<size_t> shard_size(shards_.size(), 0);
+    for (size_t i = 0; i != header.num_exprs; ++i) {
+        auto n = node(i);
+        if (n.gid >= header.num_gids || index[n.gid] != Nil || n.tag > Tag::BB || (n.tag == Tag::BB) != bool(n.mut)) return {};
+        if (n.num_ops != arity(n.tag)) return {};
+        index[n.gid]    = uint32_t(i);
+        first_op[i + 1] = first_op[i] + n.num_ops;
+        ++shard_size[shard_index(n.hash)];
+    }
+    if (first_op.back() != header.num_ops) return {};
+    auto valid = [&](uint32_t g) { return g == Nil || (g < header.num_gids && index[g] != Nil); };
+    auto ops   = [&](uint32_t g) { return std::views::iota(first_op[index[g]], first_op[index[g] + 1]) | std::views::transform(op); };
+    for (size_t i = 0; i != header.num_exprs; ++i)
+        for (auto g : ops(node(i).gid))
+            if (!valid(g) || (g == Nil && !node(i).mut)) return {};
+
+    // only Tag::BB%s may close cycles: peel off immutable Expr%s without immutable users until none are left
+    auto is_mut = [&](uint32_t g) { return bool(node(index[g]).mut); };
+    std::vector<uint32_t> num_users(header.num_gids, 0), todo;
+    size_t num_immutable = 0;
+    for (size_t i = 0; i != header.num_exprs; ++i) {
+        if (node(i).mut) continue;
+        ++num_immutable;
+        for (auto g : ops(node(i).gid))
+            if (!is_mut(g)) ++num_users[g];
+    }
+    for (size_t i = 0; i != header.num_exprs; ++i)
+        if (auto g = node(i).gid; !node(i).mut && num_users[g] == 0) todo.emplace_back(g);
+    for (; !todo.empty(); --num_immutable) {
+        auto g = todo.back();
+        todo.pop_back();
+        for (auto o : ops(g))
+            if (!is_mut(o) && --num_users[o] == 0) todo.emplace_back(o);
+    }
+    if (num_immutable != 0) return {};
+
+    // the rep parent of each gid: recorded in the file or the first immutable user - like World::put
+    std::vector<uint32_t> parent(header.num_gids, Nil);
+    for (size_t i = 0; i != header.num_exprs; ++i) {
+        auto n = node(i);
+        if (header.aux) {
+            auto p = aux(i).parent;
+            if (!valid(p) || (p != Nil && std::ranges::count(ops(p), n.gid) == 0)) return {};
+            parent[n.gid] = p;
+        } else if (!n.mut) {
+            for (auto g : ops(n.gid))
+                if (parent[g] == Nil) parent[g] = n.gid;
+        }
+    }
+
+    // parents before children - or a cycle, which would send LinkCutTree::expose round in circles
+    std::vector<uint8_t> state(header.num_gids, 0); // 0: unvisited, 1: on the current chain, 2: done
+    std::vector<uint32_t> order, chain;
+    order.reserve(header.num_exprs);
+    for (size_t i = 0; i != header.num_exprs; ++i) {
+        chain.clear();
+        auto g = node(i).gid;
+        for (; g != Nil && state[g] == 0; g = parent[g]) {
+            state[g] = 1;
+            chain.emplace_back(g);
+        }
+        if (g != Nil && state[g] == 1) return {};
+        for (size_t j = chain.size(); j-- != 0;) {
+            state[chain[j]] = 2;
+            order.emplace_back(chain[j]);
+        }
+    }
+
+    // allocate all Expr%s - operands may refer to later gids, so they are filled in afterwards
+    static constexpr std::array<const Expr*, 256> Null_Ops = {};
+    std::vector<const Expr*> res(header.num_gids, nullptr);
+    for (size_t i = 0; i != shards_.size(); ++i) shards_[i].set.reserve(shard_size[i]);
+    for (size_t i = 0; i != header.num_exprs; ++i) {
+        auto n      = node(i);
+        auto& shard = shard_of(n.hash);
+        auto mem    = shard.arena.allocate(Expr::size_of(n.num_ops));
+        auto expr   = n.mut ? new (mem) Expr(n.gid, n.hash)
+                            : new (mem) Expr(n.gid, n.tag, std::span(Null_Ops).first(n.num_ops), n.stuff, n.hash);
+        shard.set.insert_unique(expr);
+        res[n.gid] = expr;
+    }
+
+    for (size_t i = 0, o = 0; i != header.num_exprs; ++i) {
+        auto expr = const_cast<Expr*>(res[node(i).gid]);
+        for (auto& p : expr->ops()) {
+            auto g = op(o++);
+            p      = g == Nil ? nullptr : res[g];
+        }
+        expr->add_uses();
+        if (header.aux) {
+            if (auto v = aux(i).value; v != Expr::Value()) expr->set_value(v);
+        }
+    }
+
+    // children before parents: each one is still a single node when it goes below its parent
+    for (size_t i = order.size(); i-- != 0;)
+        if (auto g = order[i]; parent[g] != Nil) res[parent[g]]->attach(res[g]);
+
+    if (!header.aux) {
+        for (size_t i = 0; i != header.num_exprs; ++i) {
+            auto expr = res[node(i).gid];
+            // like Expr::set - but, as in World::compact, Tag::BB%s may close cycles
+            if (auto body = expr->mut ? expr->op(0) : nullptr; body && !expr->connected(body)) expr->link(body);
+        }
+    }
+
+    gid = header.num_gids;
+    return res;
+}
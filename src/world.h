@@ -1,93 +1,459 @@
 #pragma once
 
-#include <unordered_set>
+#include <atomic>
+#include <bit>
+#include <deque>
+#include <mutex>
+#include <tuple>
 
+#include "arena.h"
 #include "expr.h"
+#include "stats.h"
 
+static_assert(std::is_trivially_destructible_v<Expr>, "World::Shard::arena won't run destructors");
+
+/// Creates and hash-conses Expr%s.
+/// * A default-constructed World is single-threaded and links each new Expr to its operands right away.
+/// * A *concurrent* World - see World::World(size_t) - splits its hash-consing table into Shard%s that are selected by the
+///     high bits of Expr::hash; each Shard has its own lock and Arena, so threads that hit different Shard%s never contend.
+///     World::gid is handed out atomically, so gids remain dense.
+///     Two threads that build the same Expr receive the same canonical node.
+///     However, LinkCutTree%s remain single-writer: new Expr%s are only linked to their operands by World::link.
+///
+/// Nothing that World derives from Expr%s depends on the order in which they have been built:
+/// Expr::hash is a Merkle hash of the content, and World::add orders its operands by Expr::less.
+/// So, a *deterministic* concurrent World only has to renumber the Expr%s that threads have created when it links them:
+/// afterwards, its gids - and thus anything ordered by them, the *aux* trees, and the Dot output - are bit-identical
+/// to those of any other build of the same DAG, no matter how many threads took part and how they interleaved.
+/// Use World::bb(uint64_t) to give Tag::BB%s stable identities for this.
 struct World {
+    /// Stack-resident stand-in for an immutable Expr that is used to probe World::Shard::set before anything is allocated.
+    struct Key {
+        Tag tag;
+        std::span<const Expr* const> ops;
+        uint64_t stuff;
+        size_t hash;
+    };
+    /// Probes World::Shard::set for this very Expr - not for one with the same content.
+    struct Ptr {
+        const Expr* expr;
+    };
+
     struct Hash {
+        using is_transparent = void;
         Hash() {}
         size_t operator()(const Expr* expr) const { return expr->hash; }
+        size_t operator()(const Key& key) const { return key.hash; }
+        size_t operator()(const Ptr& ptr) const { return ptr.expr->hash; }
     };
 
     struct Eq {
+        using is_transparent = void;
         Eq() {}
         bool operator()(const Expr* e1, const Expr* e2) const { return Expr::equal(e1, e2); }
+        bool operator()(const Key& k, const Expr* e) const { return Expr::equal(k.tag, k.ops, k.stuff, e); }
+        bool operator()(const Expr* e, const Key& k) const { return Expr::equal(k.tag, k.ops, k.stuff, e); }
+        bool operator()(const Ptr& p, const Expr* e) const { return p.expr == e; }
     };
 
+    /// Slice of the hash-consing table.
+    struct alignas(64) Shard {
+        Shard(World* world)
+            : arena(world) {}
+
+        std::mutex mutex; ///< Only taken by a concurrent World.
+        Arena arena;
+        FlatSet<const Expr*, Hash, Eq> set;
+        std::vector<Expr*> fresh; ///< Expr%s that a concurrent World has created since the last World::link.
+    };
+
+    /// Single-threaded World.
+    World()
+        : World(1, false, false) {}
+    /// Concurrent World with @p num_shards Shard%s (rounded up to a power of two).
+    explicit World(size_t num_shards, bool deterministic = true)
+        : World(num_shards, true, deterministic) {}
+    World(const World&)            = delete;
+    World& operator=(const World&) = delete;
     ~World() {
-        for (auto expr : set) delete expr;
+        if (Expr::speculating == this) Expr::speculating = nullptr;
+    }
+
+    uint32_t next_gid() {
+        auto res = gid.fetch_add(1, std::memory_order_relaxed);
+        assert(res < UINT32_MAX);
+        return uint32_t(res);
     }
 
-    size_t next_gid() { return gid++; }
+    /// @name Shards
+    ///@{
+    bool is_concurrent() const { return concurrent_; }
+    bool is_deterministic() const { return deterministic_; }
+    size_t num_shards() const { return shards_.size(); }
+    Shard& shard(size_t i) { return shards_[i]; }
+    const Shard& shard(size_t i) const { return shards_[i]; }
+    size_t shard_index(size_t hash) const { return shard_bits_ == 0 ? 0 : hash >> (64 - shard_bits_); }
+    Shard& shard_of(size_t hash) { return shards_[shard_index(hash)]; }
+    ///@}
 
-    const Expr* lit(uint64_t u) { return put(new Expr(*this, Tag::Lit, {}, u)); }
-    const Expr* id(char c) { return put(new Expr(*this, Tag::Id, {}, uint64_t(c))); }
+    const Expr* lit(uint64_t u) { return put(Tag::Lit, {}, u); }
+    const Expr* id(char c) { return put(Tag::Id, {}, uint64_t(c)); }
 
     const Expr* plus(const Expr* a) {
         auto ops = std::array<const Expr*, 1>{a};
-        return put(new Expr(*this, Tag::Plus, ops));
+        return put(Tag::Plus, ops);
     }
 
     const Expr* minus(const Expr* a) {
         auto ops = std::array<const Expr*, 1>{a};
-        return put(new Expr(*this, Tag::Minus, ops));
+        return put(Tag::Minus, ops);
     }
 
     const Expr* add(const Expr* a, const Expr* b) {
-        if ((a->tag != Tag::Lit && b->tag == Tag::Lit) || a->gid > b->gid) std::swap(a, b);
-
-        if (a->tag == Tag::Lit) {
-            if (a->stuff == 0) return b;
-            if (b->tag == Tag::Lit) return lit(a->stuff + b->stuff);
-        }
+        if (auto res = fold_add(a, b, [this](uint64_t u) { return lit(u); })) return res;
         auto ops = std::array<const Expr*, 2>{a, b};
-        return put(new Expr(*this, Tag::Add, ops));
+        return put(Tag::Add, ops);
     }
     const Expr* sub(const Expr* a, const Expr* b) {
         auto ops = std::array<const Expr*, 2>{a, b};
-        return put(new Expr(*this, Tag::Sub, ops));
+        return put(Tag::Sub, ops);
     }
     const Expr* mul(const Expr* a, const Expr* b) {
         auto ops = std::array<const Expr*, 2>{a, b};
-        return put(new Expr(*this, Tag::Mul, ops));
+        return put(Tag::Mul, ops);
     }
     const Expr* eq(const Expr* a, const Expr* b) {
         auto ops = std::array<const Expr*, 2>{a, b};
-        return put(new Expr(*this, Tag::Eq, ops));
+        return put(Tag::Eq, ops);
     }
 
     const Expr* select(const Expr* cond, const Expr* t, const Expr* f) {
         auto ops = std::array<const Expr*, 3>{cond, t, f};
-        return put(new Expr(*this, Tag::Select, ops));
+        return put(Tag::Select, ops);
     }
 
     const Expr* jmp(const Expr* bb, const Expr* arg) {
         auto ops = std::array<const Expr*, 2>{bb, arg};
-        return put(new Expr(*this, Tag::Jmp, ops));
+        return put(Tag::Jmp, ops);
     }
 
     const Expr* br(const Expr* cond, const Expr* t, const Expr* f) {
         auto ops = std::array<const Expr*, 3>{cond, t, f};
-        return put(new Expr(*this, Tag::Br, ops));
+        return put(Tag::Br, ops);
     }
 
+    /// Tag::BB%s are never hash-consed; World::bb(uint64_t) uses @p key instead of Expr::gid to derive Expr::hash.
+    /// So, give each BB a unique @p key to build the same CFG in a deterministic World on several threads.
+    ///@{
     Expr* bb() {
-        auto bb = new Expr(*this);
-        auto [_, ins] = set.emplace(bb);
-        assert(ins);
+        auto g = next_gid();
+        return bb(g, hash_mix(g));
+    }
+    Expr* bb(uint64_t key) { return bb(next_gid(), hash_mix(hash_combine(uint64_t(Tag::BB), key))); }
+    ///@}
+
+    /// Hash-conses the immutable Expr `(tag ops... stuff)`.
+    /// Only if there is no such Expr yet, a new one is allocated, gets a World::gid, and is linked to its @p ops -
+    /// in the *rep* forest and their use-lists - or, in a concurrent World, queued for World::link.
+    const Expr* put(Tag tag, std::span<const Expr* const> ops, uint64_t stuff = 0) {
+        auto key           = Key{tag, ops, stuff, Expr::hash_of(tag, ops, stuff)};
+        auto& shard        = shard_of(key.hash);
+        auto lock          = lock_if_concurrent(shard);
+        auto [expr, fresh] = intern(shard, key);
+        if (fresh) {
+            if (concurrent_) {
+                shard.fresh.emplace_back(const_cast<Expr*>(expr));
+            } else {
+                for (auto op : ops) expr->link(op);
+            }
+        }
+        return expr;
+    }
+
+    /// @name Bulk Construction
+    /// A *postfix program* lists the Expr%s of a DAG operands first: each Instr pushes a Tag::Lit or Tag::Id with
+    /// Instr::stuff onto a stack or pops the arity() operands of its Instr::tag and pushes the result; e.g.,
+    /// `a 2 + b *` builds `(* (+ 2 a) b)`. Tag::BB%s can't be built this way.
+    ///
+    /// World::build yields the same Expr%s as the corresponding calls to World::lit, World::add, etc. - but in bulk:
+    /// it reserves the hash-consing table up front and shares only the lookup and allocation with World::put.
+    /// Instead of one LinkCutTree::link - two exposes - per operand, each new Expr goes below its first new user in O(1)
+    /// via LinkCutTree::attach; older Expr%s that are still *rep* roots go below their first new user at the end -
+    /// once each, no matter how often they occur. So, the *rep* forest ends up the same as with World::put.
+    ///@{
+    struct Instr {
+        Tag tag;
+        uint64_t stuff = 0; ///< Only for Tag::Lit and Tag::Id.
+    };
+
+    /// Runs the postfix program @p instrs and returns the remaining stack, i.e. the roots in order.
+    /// If an Instr finds too few operands on the stack or has Tag::BB, World::build does nothing and returns an empty vector.
+    /// @warning Single-threaded World%s only.
+    std::vector<const Expr*> build(std::span<const Instr> instrs);
+    ///@}
+
+    /// Links all Expr%s that a concurrent World has created since the last call to their operands.
+    /// This happens in World::gid order, so the result does not depend on the Shard%s the Expr%s went to.
+    /// A deterministic World renumbers these Expr%s beforehand; see World::renumber.
+    /// @warning Not thread-safe: call it once no other thread uses this World.
+    void link() {
+        std::vector<Expr*> fresh;
+        for (auto& shard : shards_) {
+            fresh.insert(fresh.end(), shard.fresh.begin(), shard.fresh.end());
+            shard.fresh.clear();
+        }
+        std::ranges::sort(fresh, GIDLt<const Expr*>());
+        if (deterministic_) renumber(fresh);
+
+        for (auto expr : fresh) {
+            if (!expr->mut) {
+                expr->add_uses();
+                for (auto op : expr->ops()) expr->link(op);
+            }
+        }
+    }
+
+    /// @name Garbage Collection
+    ///@{
+    /// Frees all Expr%s that are not reachable from @p roots via Expr::ops - following Tag::BB%s, too.
+    /// Dead Expr%s leave their Shard's hash-consing table and their memory goes back to the Shard's Arena for reuse.
+    /// Live Expr%s whose *rep* parent dies are cut from it and become roots of their own *rep* trees.
+    /// This only requires - as World ensures - that each *rep* parent is a user of its child:
+    /// then, dead Expr%s only have dead *rep* ancestors and it suffices to check the operands of the dead Expr%s.
+    ///
+    /// With @p compact, the survivors move to fresh Arena%s instead and receive the gids `0, 1, ...` in
+    /// post-order from @p roots: operands precede their users and related Expr%s end up next to each other in memory.
+    /// Their *rep* trees are rebuilt in the new gid order and LinkCutTree::value%s are retained.
+    /// @p roots are updated in place; any other pointer to an Expr of this World becomes dangling.
+    /// @returns the number of freed Expr%s.
+    /// @warning Not thread-safe; call World::link beforehand.
+    /// Gid-indexed side tables - like a DomTree - have to be rebuilt after compacting.
+    size_t gc(std::span<const Expr*> roots, bool compact = false);
+    ///@}
+
+    /// @name Uses
+    /// Replaces each use of @p old with @p nu, which must not depend on @p old, and keeps everything else in sync:
+    /// * Each user of @p old moves from the use-list of @p old to the one of @p nu via Expr::set_op.
+    ///     A user that was the *rep* parent of @p old cuts it off; @p nu goes below the user if it is a *rep* root -
+    ///     unless that would close a cycle. So, each *rep* parent remains a user of its child.
+    /// * Each immutable user is hash-consed again with its new operands - Tag::Add%s are put back into World::add's order.
+    ///     Since Expr::hash is a Merkle hash, this ripples up through the users of users - up to the next Tag::BB -
+    ///     in one pass that visits operands before their users.
+    /// * A user that turns into a duplicate of an existing Expr - even of @p old itself, as in `-(-y)` with `-y` := `y` -
+    ///     is merged into it: its users are redirected in turn,
+    ///     and it drops out of the hash-consing table as well as all use-lists with Expr::ops of `nullptr`.
+    ///     Then, it goes back to its Arena - within a World::checkpoint only once the outermost one commits.
+    ///     Literals are not folded again, though.
+    ///
+    /// This costs O(log n) amortized per Use of @p old plus O(1) per Use of the Expr%s above -
+    /// it only depends on the part of the DAG above @p old, never on World::gid.
+    /// Works within a World::checkpoint, too.
+    /// @warning Single-threaded World%s only.
+    void replace_all_uses_with(const Expr* old, const Expr* nu);
+    ///@}
+
+    /// @name Speculation
+    /// World::checkpoint starts a speculative rewrite that World::rollback undoes or World::commit keeps.
+    /// Meanwhile, World keeps an undo log of
+    /// * the *aux* part of each Expr - its LinkCutTree base - right before its first change since the checkpoint;
+    /// * each Expr::set_op with the old operand;
+    /// * each Expr::hash that World::replace_all_uses_with changes - along with the Expr's place in the hash-consing table;
+    /// * each Expr that World::put or World::bb has created.
+    ///
+    /// So, World::rollback costs O(changes): it copies the saved *aux* parts and operands back in reverse and removes
+    /// the new Expr%s from the hash-consing table and the Arena%s - without a single splay.
+    /// Afterwards, World::gid is back where it was at the checkpoint.
+    /// Checkpoints nest; World::rollback and World::commit always refer to the innermost one.
+    /// @warning Single-threaded World%s only; the undo log is attached to the calling thread - see Expr::speculating.
+    /// Don't call World::gc or World::load while a checkpoint is active.
+    ///@{
+    void checkpoint();
+    void rollback();
+    void commit();
+    size_t num_checkpoints() const { return marks_.size(); }
+    ///@}
+
+    /// @name Snapshots
+    /// Binary image of all Expr%s in World::gid order with their Expr::tag, Expr::stuff, Expr::hash, and operand gids.
+    /// With @p aux, it also records the *rep* parent and LinkCutTree::value of each Expr.
+    ///
+    /// World::load maps the file into memory and rebuilds the World in bulk: it neither recomputes any Expr::hash nor
+    /// probes for duplicates, and it restores the *rep* forest in O(1) per Expr via LinkCutTree::attach,
+    /// as each *aux* tree starts out as a single node whose path parent is its *rep* parent.
+    /// Without the @p aux part, it links each immutable Expr below its first user in World::gid order - just like World::put -
+    /// and each Tag::BB to its body - just like Expr::set, unless that would close a cycle.
+    /// The gids are retained: the result maps each gid to its Expr (`nullptr` for gids that World::gc has freed).
+    /// The file uses the host's byte order; if it is missing or malformed - this includes *rep* parents that aren't users
+    /// of their children or form a cycle - World::load does nothing and returns an empty vector.
+    /// @warning Not thread-safe; World::load expects a World without any Expr%s.
+    ///@{
+    /// File layout: Header, Node[num_exprs], `uint32_t` operand gids[num_ops], Aux[num_exprs] if Header::aux.
+    struct Snapshot {
+        struct Header {
+            uint64_t magic;
+            uint64_t num_gids;
+            uint64_t num_exprs;
+            uint64_t num_ops;
+            uint64_t aux;
+        };
+
+        struct Node {
+            uint32_t gid;
+            Tag tag;
+            uint8_t mut;
+            uint8_t num_ops;
+            uint8_t pad;
+            uint64_t stuff;
+            uint64_t hash;
+        };
+
+        struct Aux {
+            uint32_t parent;
+            Expr::Value value;
+        };
+    };
+
+    void save(std::ostream&, bool aux = true) const;
+    bool save(const std::string& file, bool aux = true) const;
+    std::vector<const Expr*> load(const std::string& file);
+    ///@}
+
+    /// @name Stats
+    /// Snapshot of the hot-path counters of this thread; see stats.h.
+    /// All zero, unless compiled with `LCEXPR_STATS`.
+    ///@{
+    static stats::Counters stats() { return stats::counters(); }
+    static std::ostream& dump_stats(std::ostream& os) { return stats().dump(os); }
+    ///@}
+
+    static void count_put([[maybe_unused]] bool hit, [[maybe_unused]] size_t probe) {
+        if constexpr (stats::enabled) {
+            auto& c = stats::counters();
+            ++c.num_puts;
+            c.num_hits += hit;
+            stats::sample(c.probe, c.max_probe, probe);
+        }
+    }
+
+    std::atomic<size_t> gid = 0;
+
+private:
+    World(size_t num_shards, bool concurrent, bool deterministic)
+        : concurrent_(concurrent)
+        , deterministic_(deterministic)
+        , shard_bits_(std::bit_width(std::max<size_t>(num_shards, 1) - 1)) {
+        for (size_t i = 0, e = size_t(1) << shard_bits_; i != e; ++i) shards_.emplace_back(this);
+    }
+
+    /// Operand order of Tag::Add: literals first, then by content.
+    static bool in_order(const Expr* a, const Expr* b) {
+        auto lit_a = a->tag == Tag::Lit, lit_b = b->tag == Tag::Lit;
+        return lit_a != lit_b ? lit_a : !Expr::less(b, a);
+    }
+
+    /// Brings `a + b` into normal form for World::add and World::build: sorts @p a and @p b via in_order and
+    /// folds `0 + b` to `b` and the sum of two literals to a new one - created by @p lit.
+    /// @returns the folded Expr or `nullptr` if a Tag::Add with the sorted operands is needed.
+    template<class F>
+    static const Expr* fold_add(const Expr*& a, const Expr*& b, F lit) {
+        if (!in_order(a, b)) std::swap(a, b);
+        if (a->tag == Tag::Lit) {
+            if (a->stuff == 0) return b;
+            if (b->tag == Tag::Lit) return lit(a->stuff + b->stuff);
+        }
+        return nullptr;
+    }
+
+    Expr* bb(uint32_t gid, size_t hash) {
+        auto& shard = shard_of(hash);
+        auto lock   = lock_if_concurrent(shard);
+        auto bb     = new (shard.arena.allocate(Expr::size_of(1))) Expr(gid, hash);
+        shard.set.insert_unique(bb);
+        if (concurrent_) shard.fresh.emplace_back(bb);
+        if (!marks_.empty()) exprs_.emplace_back(bb);
         return bb;
     }
 
-    const Expr* put(const Expr* expr) {
-        auto [i, ins] = set.emplace(expr);
-        if (ins) return expr;
-        --gid;
-        delete expr;
-        return *i;
+    /// Looks up @p key in @p shard or allocates a new Expr for it, whose Use%s go right into the use-lists of its operands -
+    /// unless this World is concurrent; the *rep* forest is up to the caller. @returns the Expr and whether it is new.
+    /// @warning In a concurrent World, the caller has to hold the lock of @p shard.
+    std::pair<const Expr*, bool> intern(Shard& shard, const Key& key) {
+        if (auto i = shard.set.find(key); i != shard.set.end()) {
+            count_put(true, shard.set.probe_length(i));
+            return {*i, false};
+        }
+
+        auto expr = new (shard.arena.allocate(Expr::size_of(key.ops.size())))
+            Expr(next_gid(), key.tag, key.ops, key.stuff, key.hash);
+        auto i = shard.set.insert_unique(expr);
+        count_put(false, shard.set.probe_length(i));
+        if (!marks_.empty()) exprs_.emplace_back(expr);
+        if (!concurrent_) expr->add_uses();
+        return {expr, true};
+    }
+
+    /// Hands out the gids of @p fresh - all Expr%s created since the last World::link in World::gid order - anew:
+    /// by height in the DAG first, so operands still precede their users, and then by Expr::less.
+    void renumber(std::span<Expr*> fresh) {
+        if (fresh.empty()) return;
+        auto base = fresh.front()->gid;
+        assert(base + fresh.size() == gid && "all Expr%s since the last World::link must be fresh");
+
+        std::vector<uint32_t> height(fresh.size(), 0);
+        for (auto expr : fresh) {
+            if (expr->mut) continue;
+            auto& h = height[expr->gid - base];
+            for (auto op : expr->ops())
+                if (op->gid >= base) h = std::max(h, height[op->gid - base] + 1);
+        }
+
+        std::ranges::sort(fresh, [&](const Expr* a, const Expr* b) {
+            auto ha = height[a->gid - base], hb = height[b->gid - base];
+            return ha != hb ? ha < hb : Expr::less(a, b);
+        });
+        for (uint32_t i = 0, e = uint32_t(fresh.size()); i != e; ++i) fresh[i]->gid = base + i;
+    }
+
+    std::vector<const Expr*> mark(std::span<const Expr* const> roots, std::vector<bool>& live) const;
+    void users_above(std::span<Expr* const> roots, std::vector<Expr*>& order) const;
+    void compact(std::span<const Expr* const> order, std::span<const Expr*> roots);
+
+    std::unique_lock<std::mutex> lock_if_concurrent(Shard& shard) {
+        return concurrent_ ? std::unique_lock(shard.mutex) : std::unique_lock<std::mutex>();
+    }
+
+    /// @name Undo Log
+    /// Called by Expr while Expr::speculating points to this World.
+    ///@{
+    void journal_aux(const Expr* expr) {
+        auto g = expr->gid;
+        if (g >= marks_.back().gid) return; // dies anyway on rollback
+        if (g >= stamps_.size()) stamps_.resize(gid, 0);
+        if (std::exchange(stamps_[g], serial_) == serial_) return;
+        auxs_.emplace_back(expr, *expr);
+    }
+    void journal_op(Expr* expr, size_t i) {
+        if (expr->gid < marks_.back().gid) ops_.emplace_back(expr, i, expr->op(i));
     }
+    friend struct Expr;
+    ///@}
+
+    /// Lengths of the logs and World::gid at a World::checkpoint.
+    struct Mark {
+        size_t num_auxs, num_ops, num_hashes, num_exprs, num_merged, gid;
+    };
 
-    size_t gid = 0;
-    std::unordered_set<const Expr*, Hash, Eq> set;
+    bool concurrent_;
+    bool deterministic_;
+    int shard_bits_;
+    std::deque<Shard> shards_;
+    std::vector<Mark> marks_;
+    std::vector<std::pair<const Expr*, Expr::LinkCutTree>> auxs_; ///< Expr + its *aux* part before the first change.
+    std::vector<std::tuple<Expr*, size_t, const Expr*>> ops_;     ///< Expr + operand index + old operand.
+    std::vector<std::pair<Expr*, size_t>> hashes_;                ///< Expr + old Expr::hash; it was in the table back then.
+    std::vector<Expr*> exprs_;                                    ///< Expr%s created since the outermost checkpoint.
+    std::vector<Expr*> merged_; ///< Expr%s that World::replace_all_uses_with has merged; freed by the outermost World::commit.
+    std::vector<uint32_t> stamps_; ///< Expr::gid -> serial_ when auxs_ got a copy of this Expr; avoids duplicates.
+    uint32_t serial_ = 0;          ///< Bumped whenever the innermost checkpoint changes.
 };
 